@@ -18,6 +18,29 @@
 #include <sstream>
 #include <algorithm>
 #include <stdexcept>
+#include <filesystem>
+#include <functional>
+#include <charconv>
+#include <string_view>
+#include <cstdint>
+#include <map>
+#include <climits>
+#include <chrono>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include "hty_encoding.hpp"
+#include "hty_roaring.hpp"
+#include "hty_stats.hpp"
 
 using json = nlohmann::json;
 
@@ -26,51 +49,286 @@ using json = nlohmann::json;
 #define PRECISION_LARGE 5
 #define PRECISION_NORMAL 2
 
+// Staging buffer for copies the kernel cannot do directly and for new rows
+#define COPY_BUFFER_SIZE (8 << 20)
+
+// Constants for delta segment compaction
+#define COMPACT_MAX_SEGMENTS 8                 // Segments per group, base included
+#define COMPACT_MAX_DELTA_BYTES (64LL << 20)   // Bytes held in delta segments
+#define COMPACT_MAX_DELETED_RATIO 0.2          // Share of rows marked deleted
+#define REWRITE_TMP_SUFFIX ".tmp"
+#define WRITER_LOCK_SUFFIX ".lock"
+
+// Constants for the write-ahead log of appends
+#define WAL_SUFFIX ".wal"
+#define WAL_MAGIC "HTYWAL01"
+#define WAL_RECORD_MAGIC 0x52574c48u           // "HLWR"
+
+// Rows handed to the append path at a time by bulk ingestion
+#define BULK_BATCH_BYTES (64 << 20)
+
+// Constants for secondary index sidecar files
+#define INDEX_SUFFIX ".idx"
+#define INDEX_MAGIC "HTYIDX02"
+#define INDEX_PAGE_ENTRIES 512          // Entries per page, one fence key per page
+#define INDEX_MAX_SELECTIVITY 0.1       // Largest share of rows an index lookup may return
+#define BITMAP_INDEX_SUFFIX ".bmx"
+#define BITMAP_INDEX_MAGIC "HTYBMX02"
+#define BITMAP_INDEX_MAX_VALUES 4096    // Most distinct values a bitmap index holds
+
+// Fetching rows by id
+#define FETCH_PREFETCH_RANGES 32        // Ranges announced to the kernel ahead of reading
+
+// I/O cost model, used until calibrate measures the file's storage
+#define IO_COST_SUFFIX ".iocost"
+#define IO_SEEK_MICROS 100.0            // One small random read
+#define IO_BYTES_PER_MICRO 500.0        // Sequential bandwidth, 500 MB/s
+#define CALIBRATE_MIN_BYTES (4 << 20)
+#define CALIBRATE_SEQUENTIAL_BYTES (256LL << 20)
+#define CALIBRATE_SEEKS 64
+#define CALIBRATE_READ_BYTES 4096
+
+/**
+ * @brief Run of rows belonging to one column group
+ *
+ * A freshly converted file stores each group as a single row-major segment
+ * at the group's offset, or as a list of columnar blocks. Every in-place
+ * append adds one more row-major (delta) segment per group at the end of
+ * the file, so readers walk the segments in order.
+ */
+struct Segment {
+    long long offset;   // File offset of the first row in the segment
+    int num_rows;       // Number of rows stored in the segment
+    json chunks;        // One entry per column for a columnar block, null if row-major
+    json zones;         // Zone map entry per column of a row-major segment, null if none
+};
+
+/**
+ * @brief New rows split by column group
+ *
+ * Each group's slice is laid out exactly as it is stored on disk (row-major
+ * within the group), so a slice can be written with a single call.
+ */
+struct RowBatch {
+    int num_rows = 0;                          // Rows held by the batch
+    std::vector<std::vector<float>> groups;    // num_rows * num_columns values per group
+};
+
+/**
+ * @brief Fixed header at the start of the write-ahead log
+ *
+ * Besides the log position of its first record, the header records the
+ * length of the HTY file at its last published footer. Anything past that
+ * length was never committed and is cut off by recovery.
+ */
+struct WalHeader {
+    char magic[8];
+    uint64_t base_lsn;          // Log position of the first byte after the header
+    uint64_t committed_length;  // HTY file length at the last published footer
+    uint64_t inode;             // HTY inode the committed length refers to
+};
+
+/**
+ * @brief Header of one logged batch; the payload follows it
+ *
+ * A record's log position (LSN) is the position just past its payload,
+ * so a footer's wal_lsn tells exactly which records it already contains.
+ * The LSN is stored in the record rather than derived from its offset, so
+ * replay stays correct even if a checkpoint was cut short after moving
+ * base_lsn but before truncating the log.
+ */
+struct WalRecordHeader {
+    uint32_t magic;
+    uint32_t num_rows;
+    uint64_t payload_size;      // Group slices of the batch, in group order
+    uint64_t lsn;               // Log position just past the payload
+    uint32_t checksum;          // CRC-32 of the header (checksum zeroed) and payload
+    uint32_t reserved;
+};
+
+/**
+ * @brief Fixed header at the start of a secondary index file
+ *
+ * The column name follows the header, then the entries sorted by value
+ * and row, then one fence key (the first value) per page of entries.
+ * Row ids only hold for the file (by its file_id) and the generation the
+ * index was built on; rows appended since, at or past num_rows, are not
+ * indexed.
+ */
+struct IndexHeader {
+    char magic[8];
+    uint64_t file_id;           // Random id the converter gave the HTY file
+    uint64_t generation;        // Generation of the HTY file, bumped by every rewrite
+    uint64_t num_rows;          // Rows of the HTY file covered by the index
+    uint64_t num_entries;       // Live, non-null rows of the column
+    uint32_t page_entries;      // Entries per page
+    uint32_t name_size;         // Bytes of the column name
+};
+
+/**
+ * @brief One indexed row: its value and row id
+ */
+struct IndexEntry {
+    float value;
+    uint32_t row;
+};
+
+/**
+ * @brief Fixed header at the start of a bitmap index file
+ *
+ * The column name follows the header, then one BitmapIndexValue per
+ * distinct value in ascending order, then the compressed bitmap of each
+ * value's rows. Row ids hold for one file and generation, as in IndexHeader.
+ */
+struct BitmapIndexHeader {
+    char magic[8];
+    uint64_t file_id;           // Random id the converter gave the HTY file
+    uint64_t generation;        // Generation of the HTY file, bumped by every rewrite
+    uint64_t num_rows;          // Rows of the HTY file covered by the index
+    uint64_t num_values;        // Distinct values of the column
+    uint32_t reserved;
+    uint32_t name_size;         // Bytes of the column name
+};
+
+/**
+ * @brief One distinct value of a bitmap index and where its bitmap is
+ */
+struct BitmapIndexValue {
+    float value;
+    uint32_t cardinality;       // Live rows holding the value
+    uint64_t offset;            // Offset of the serialized bitmap in the index file
+    uint64_t size;              // Bytes of the serialized bitmap
+};
+
+/**
+ * @brief Finds where the last published footer of an HTY file ends
+ *
+ * Writers append a new footer after the old one and only then publish the
+ * new length in the log header, so bytes past the published length may be
+ * a half-written append. Files without a log, or whose log describes an
+ * older inode, end at their last byte.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] hty_stat Status of the opened HTY file
+ * @return Length of the file up to the end of its published footer
+ */
+long long committed_length(const std::string& hty_file_path, const struct stat& hty_stat) {
+    int wal_fd = open((hty_file_path + WAL_SUFFIX).c_str(), O_RDONLY);
+    if (wal_fd < 0) {
+        return hty_stat.st_size;
+    }
+
+    WalHeader header;
+    bool valid = pread(wal_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                 memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) == 0 &&
+                 hty_stat.st_ino == header.inode &&
+                 static_cast<off_t>(header.committed_length) <= hty_stat.st_size;
+    close(wal_fd);
+    return valid ? static_cast<long long>(header.committed_length) : hty_stat.st_size;
+}
+
 /**
- * @brief Filter operations enumeration
+ * @brief A pinned version of an HTY file
+ *
+ * Holds the descriptor extract_metadata read the footer from, so reads that
+ * go through open_snapshot keep seeing that version, even after a writer
+ * appends past it or compaction renames a new file into place. The
+ * descriptor is closed when the snapshot goes out of scope. An empty
+ * snapshot reads whatever the path currently names.
  */
-enum FilterOperation {
-    GREATER_THAN,     // >
-    GREATER_EQUAL,    // >=
-    LESS_THAN,       // <
-    LESS_EQUAL,      // <=
-    EQUAL,           // =
-    NOT_EQUAL        // !=
+struct Snapshot {
+    int fd = -1;                // Pinned descriptor, -1 if nothing is pinned
+
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
 };
 
 /**
  * @brief Extracts metadata from an HTY file
+ *
+ * With a snapshot, the descriptor the footer was read from stays open in
+ * it, pinning that footer version for later reads. Appends never modify
+ * bytes before the published length. Nothing here takes a lock, so readers
+ * never wait for writers. Writers, which already hold the writer lock,
+ * read an unpinned footer.
+ *
  * @param[in] hty_file_path Path to the HTY file to read
+ * @param[out] snapshot Receives the pinned version, or nullptr to pin nothing
  * @return json object containing the file's metadata
  */
-json extract_metadata(const std::string& hty_file_path) {
-    std::ifstream file(hty_file_path, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
+json extract_metadata(const std::string& hty_file_path, Snapshot* snapshot = nullptr) {
+    int fd = open(hty_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
         return json();
     }
 
     try {
-        // Read metadata size from end of file
-        std::streamsize file_size = file.tellg();
-        file.seekg(-static_cast<int>(sizeof(int)), std::ios::end);
-        int metadata_size;
-        file.read(reinterpret_cast<char*>(&metadata_size), sizeof(int));
+        // Read metadata size from the end of the published footer
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            throw std::runtime_error("unable to stat file");
+        }
+        long long footer_end = committed_length(hty_file_path, file_stat);
+        int metadata_size = 0;
+        if (pread(fd, &metadata_size, sizeof(int), footer_end - sizeof(int)) != sizeof(int) ||
+            metadata_size < 0 || metadata_size > footer_end - static_cast<long long>(sizeof(int))) {
+            throw std::runtime_error("invalid metadata size");
+        }
 
         // Read metadata content
-        file.seekg(-static_cast<int>(sizeof(int)) - metadata_size, std::ios::end);
-        std::vector<char> metadata_buffer(metadata_size);
-        file.read(metadata_buffer.data(), metadata_size);
-        file.close();
+        std::string metadata_str(metadata_size, '\0');
+        if (pread(fd, metadata_str.data(), metadata_size,
+                  footer_end - sizeof(int) - metadata_size) != metadata_size) {
+            throw std::runtime_error("truncated metadata");
+        }
+        json metadata = json::parse(metadata_str);
 
-        std::string metadata_str(metadata_buffer.begin(), metadata_buffer.end());
-        return json::parse(metadata_str);
+        if (snapshot) {
+            if (snapshot->fd >= 0) {
+                close(snapshot->fd);
+            }
+            snapshot->fd = fd;
+        } else {
+            close(fd);
+        }
+        return metadata;
     } catch (const std::exception& e) {
         std::cerr << "Error parsing metadata: " << e.what() << std::endl;
+        close(fd);
         return json();
     }
 }
 
+/**
+ * @brief Gives the path that reaches a pinned file version
+ * @param[in] snapshot Snapshot taken by extract_metadata
+ * @param[in] hty_file_path Path to the HTY file
+ * @return Path of the pinned descriptor, or hty_file_path if nothing is pinned
+ */
+std::string snapshot_path(const Snapshot& snapshot, const std::string& hty_file_path) {
+    if (snapshot.fd < 0) {
+        return hty_file_path;
+    }
+    return "/proc/self/fd/" + std::to_string(snapshot.fd);
+}
+
+/**
+ * @brief Opens a pinned file version
+ * @param[in] snapshot Snapshot taken by extract_metadata
+ * @param[in] hty_file_path Path to the HTY file
+ * @return Stream reading the pinned version
+ */
+std::ifstream open_snapshot(const Snapshot& snapshot, const std::string& hty_file_path) {
+    return std::ifstream(snapshot_path(snapshot, hty_file_path), std::ios::binary);
+}
+
 /**
  * @brief Gets column information including index and group
  * @param[in] metadata JSON metadata of the HTY file
@@ -96,14 +354,91 @@ std::pair<int, int> get_column_info(const json& metadata, const std::string& col
     return {-1, -1};
 }
 
+/**
+ * @brief Lists the segments of a column group in row order
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] group_index Index of the column group
+ * @return Vector of segments, a single one if the group has no deltas
+ */
+std::vector<Segment> get_group_segments(const json& metadata, int group_index) {
+    const auto& group = metadata["groups"][group_index];
+    std::vector<Segment> segments;
+
+    if (!group.contains("segments")) {
+        segments.push_back({group["offset"].get<long long>(),
+                            metadata["num_rows"].get<int>(), json(),
+                            group.value("zones", json())});
+        return segments;
+    }
+
+    for (const auto& segment : group["segments"]) {
+        segments.push_back({segment["offset"].get<long long>(),
+                            segment["num_rows"].get<int>(),
+                            segment.value("chunks", json()),
+                            segment.value("zones", json())});
+    }
+    return segments;
+}
+
+/**
+ * @brief Reads the zone map of one column in a segment
+ * @param[in] segment Segment of the column's group
+ * @param[in] column_index Index of the column within its group
+ * @return Zone of the column, unknown if the segment recorded none
+ */
+ZoneMap segment_zone(const Segment& segment, int column_index) {
+    if (!segment.chunks.is_null()) {
+        return zone_from_chunk(segment.chunks[column_index], segment.num_rows);
+    }
+    if (segment.zones.is_array() && column_index < static_cast<int>(segment.zones.size())) {
+        return zone_from_entry(segment.zones[column_index]);
+    }
+    return zone_from_entry(json());
+}
+
+/**
+ * @brief Checks whether a group is stored as columnar blocks
+ * @param[in] group Group entry of the metadata
+ * @return true if the converter or a rewrite wrote the group in blocks
+ */
+bool is_columnar_group(const json& group) {
+    return group.contains("block_rows");
+}
+
+/**
+ * @brief Serializes the metadata followed by its 4-byte size
+ * @param[in] metadata JSON metadata to serialize
+ * @return Footer bytes ready to be written after the raw data
+ */
+std::string serialize_footer(const json& metadata) {
+    std::string footer = metadata.dump();
+    int metadata_size = static_cast<int>(footer.size());
+    footer.append(reinterpret_cast<const char*>(&metadata_size), sizeof(int));
+    return footer;
+}
+
+/**
+ * @brief Writes the metadata and its size at the current output position
+ * @param[in] output Stream positioned at the end of the raw data
+ * @param[in] metadata JSON metadata to serialize
+ * @return Number of bytes written
+ */
+long long write_footer(std::ostream& output, const json& metadata) {
+    std::string footer = serialize_footer(metadata);
+    output.write(footer.data(), footer.size());
+    return static_cast<long long>(footer.size());
+}
+
 /**
  * @brief Formats large numbers with appropriate precision
  * @param[in] value Number to format
  * @return Formatted string representation of the number
  */
-std::string format_large_number(float value) {
+std::string format_large_number(double value) {
     std::ostringstream oss;
-    if (std::abs(value) >= BILLION) {
+    if (std::isnan(value)) {
+        return "";   // Null
+    } else if (std::abs(value) >= BILLION) {
         oss << std::scientific << std::setprecision(PRECISION_LARGE) << value;
         std::string result = oss.str();
         size_t e_pos = result.find('e');
@@ -129,18 +464,214 @@ std::string format_large_number(float value) {
     }
 }
 
+/**
+ * @brief Counts the 64-bit words needed for a bitmap of num_bits bits
+ * @param[in] num_bits Number of bits
+ * @return Number of words
+ */
+size_t bitmap_words(long long num_bits) {
+    return static_cast<size_t>((num_bits + 63) / 64);
+}
+
+/**
+ * @brief Tests one bit of a bitmap, treating bits past its end as clear
+ * @param[in] bitmap Bitmap to test
+ * @param[in] bit Index of the bit
+ * @return true if the bit is set
+ */
+bool test_bit(const std::vector<uint64_t>& bitmap, long long bit) {
+    return static_cast<size_t>(bit / 64) < bitmap.size() && (bitmap[bit / 64] >> (bit % 64) & 1);
+}
+
+/**
+ * @brief Loads the deletion vector of an HTY file
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @return Bitmap with a set bit per deleted row, empty if none were deleted
+ */
+std::vector<uint64_t> load_deleted_rows(const json& metadata, std::istream& file) {
+    std::vector<uint64_t> deleted;
+    if (!metadata.contains("deletion_vector")) {
+        return deleted;
+    }
+
+    const auto& vector = metadata["deletion_vector"];
+    deleted.resize(vector["num_words"].get<size_t>());
+    file.seekg(vector["offset"].get<long long>());
+    file.read(reinterpret_cast<char*>(deleted.data()), deleted.size() * sizeof(uint64_t));
+    return deleted;
+}
+
+/**
+ * @brief Builds the bitmap of rows that have not been deleted
+ *
+ * Rows appended after the deletion vector was written are past its end
+ * and count as live.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @return Live-row bitmap, empty if no row was ever deleted
+ */
+std::vector<uint64_t> load_live_rows(const json& metadata, std::istream& file) {
+    std::vector<uint64_t> live = load_deleted_rows(metadata, file);
+    if (live.empty()) {
+        return live;
+    }
+
+    long long num_rows = metadata["num_rows"].get<long long>();
+    size_t deleted_words = live.size();
+    live.resize(bitmap_words(num_rows), 0);
+    for (size_t i = 0; i < live.size(); ++i) {
+        live[i] = i < deleted_words ? ~live[i] : ~0ULL;
+    }
+    if (num_rows % 64 != 0) {
+        live.back() &= (1ULL << (num_rows % 64)) - 1;
+    }
+    return live;
+}
+
+/**
+ * @brief Reads the payload of one chunk of a columnar block
+ *
+ * Compressed chunks are decompressed here, one chunk at a time, so the
+ * scan that asked for the chunk decodes it straight from the result.
+ *
+ * @param[in] file Open HTY file
+ * @param[in] chunk Chunk entry of the segment
+ * @return Encoded chunk payload
+ */
+std::string read_chunk(std::istream& file, const json& chunk) {
+    std::string bytes(chunk["size"].get<size_t>(), '\0');
+    file.seekg(chunk["offset"].get<long long>());
+    file.read(bytes.data(), bytes.size());
+    if (!chunk.contains("compression")) {
+        return bytes;
+    }
+
+    std::string payload(chunk["raw_size"].get<size_t>(), '\0');
+    if (!lz_decompress(bytes, payload.data(), payload.size())) {
+        throw std::runtime_error("Corrupt compressed chunk at offset " +
+                                 std::to_string(chunk["offset"].get<long long>()));
+    }
+    return payload;
+}
+
+/**
+ * @brief Reads the validity bitmap of a chunk
+ * @param[in] file Open HTY file
+ * @param[in] chunk Chunk entry of the segment
+ * @param[in] num_rows Number of rows in the chunk
+ * @return Bitmap with a set bit per non-null row, empty if the chunk has no nulls
+ */
+std::vector<uint64_t> read_validity(std::istream& file, const json& chunk, int num_rows) {
+    std::vector<uint64_t> validity;
+    if (chunk.value("null_count", 0) == 0) {
+        return validity;
+    }
+    validity.resize(bitmap_words(num_rows));
+    file.seekg(chunk["validity_offset"].get<long long>());
+    file.read(reinterpret_cast<char*>(validity.data()), validity.size() * sizeof(uint64_t));
+    return validity;
+}
+
+/**
+ * @brief Reads one column of a segment, whatever its layout
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @param[in] group_index Index of the column's group
+ * @param[in] segment Segment to read
+ * @param[in] column_index Index of the column within its group
+ * @return Vector of the segment's values, NaN for nulls
+ */
+std::vector<float> read_segment_column(const json& metadata, std::istream& file,
+                                       int group_index, const Segment& segment,
+                                       int column_index) {
+    const auto& group = metadata["groups"][group_index];
+    bool is_int = is_int_column(group["columns"][column_index]);
+    if (!segment.chunks.is_null()) {
+        const auto& chunk = segment.chunks[column_index];
+        auto values = decode_chunk(chunk, read_chunk(file, chunk), segment.num_rows, is_int);
+        auto validity = read_validity(file, chunk, segment.num_rows);
+        for (size_t word = 0; word < validity.size(); ++word) {
+            uint64_t nulls = ~validity[word];
+            while (nulls != 0) {
+                size_t row = word * 64 + __builtin_ctzll(nulls);
+                if (row >= values.size()) {
+                    break;
+                }
+                values[row] = NAN;
+                nulls &= nulls - 1;
+            }
+        }
+        return values;
+    }
+
+    int num_columns = group["num_columns"];
+    std::vector<float> result(segment.num_rows);
+    for (int i = 0; i < segment.num_rows; ++i) {
+        file.seekg(segment.offset +
+                   (static_cast<long long>(i) * num_columns + column_index) * sizeof(float));
+        file.read(reinterpret_cast<char*>(&result[i]), sizeof(float));
+        result[i] = load_value(result[i], is_int);
+    }
+    return result;
+}
+
+/**
+ * @brief Reads every stored row of one column, deleted rows included
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @param[in] group_index Index of the column's group
+ * @param[in] column_index Index of the column within its group
+ * @return Vector of num_rows values
+ */
+std::vector<float> read_column(const json& metadata, std::istream& file,
+                               int group_index, int column_index) {
+    std::vector<float> result;
+    result.reserve(metadata["num_rows"].get<int>());
+    for (const auto& segment : get_group_segments(metadata, group_index)) {
+        auto values = read_segment_column(metadata, file, group_index, segment, column_index);
+        result.insert(result.end(), values.begin(), values.end());
+    }
+    return result;
+}
+
+/**
+ * @brief Keeps the values whose bit is set in a selection bitmap
+ * @param[in] values Values of every stored row
+ * @param[in] selection Selection bitmap, empty to keep everything
+ * @return Selected values in row order
+ */
+std::vector<float> select_values(const std::vector<float>& values,
+                                 const std::vector<uint64_t>& selection) {
+    if (selection.empty()) {
+        return values;
+    }
+
+    std::vector<float> result;
+    for (size_t word = 0; word < selection.size(); ++word) {
+        uint64_t bits = selection[word];
+        while (bits != 0) {
+            result.push_back(values[word * 64 + __builtin_ctzll(bits)]);
+            bits &= bits - 1;
+        }
+    }
+    return result;
+}
+
 /**
  * @brief Projects a single column from the HTY file
  * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
  * @param[in] hty_file_path Path to the HTY file
  * @param[in] projected_column Name of the column to project
  * @return Vector of float values from the specified column
  */
-std::vector<float> project_single_column(const json& metadata, 
+std::vector<float> project_single_column(const json& metadata, const Snapshot& snapshot, 
                                        const std::string& hty_file_path, 
                                        const std::string& projected_column) {
     std::vector<float> result;
-    std::ifstream file(hty_file_path, std::ios::binary);
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
     if (!file.is_open()) {
         std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
         return result;
@@ -153,17 +684,9 @@ std::vector<float> project_single_column(const json& metadata,
         return result;
     }
 
-    // Read data
-    const auto& group = metadata["groups"][group_index];
-    int num_rows = metadata["num_rows"];
-    int offset = group["offset"];
-    int num_columns = group["num_columns"];
-    
-    result.resize(num_rows);
-    for (int i = 0; i < num_rows; ++i) {
-        file.seekg(offset + (i * num_columns + column_index) * sizeof(float));
-        file.read(reinterpret_cast<char*>(&result[i]), sizeof(float));
-    }
+    // Read data and drop deleted rows
+    result = select_values(read_column(metadata, file, group_index, column_index),
+                           load_live_rows(metadata, file));
 
     file.close();
     return result;
@@ -185,368 +708,3724 @@ void display_column(const json& metadata,
 }
 
 /**
- * @brief Applies filter operation to a value
- * @param[in] value Value to compare
+ * @brief Binary-searches a sorted column for the first row satisfying a predicate
+ *
+ * Reads one value per step: a single seek in row-major segments, or the
+ * chunk's block, decoded once and kept for the next steps, in columnar
+ * segments.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @param[in] group_index Index of the column's group
+ * @param[in] column_index Index of the column within its group
+ * @param[in] reached Predicate, false for a prefix of the rows and true after
+ * @return First row where the predicate holds, num_rows if none
+ */
+long long find_first_row(const json& metadata, std::istream& file, int group_index,
+                         int column_index, const std::function<bool(float)>& reached) {
+    std::vector<Segment> segments = get_group_segments(metadata, group_index);
+    std::vector<long long> starts;
+    long long num_rows = 0;
+    for (const auto& segment : segments) {
+        starts.push_back(num_rows);
+        num_rows += segment.num_rows;
+    }
+
+    const auto& group = metadata["groups"][group_index];
+    bool is_int = is_int_column(group["columns"][column_index]);
+    int num_columns = group["num_columns"];
+    size_t cached = segments.size();
+    std::vector<float> block;
+    auto value_at = [&](long long row) {
+        size_t index = std::upper_bound(starts.begin(), starts.end(), row) - starts.begin() - 1;
+        const Segment& segment = segments[index];
+        long long local = row - starts[index];
+        if (!segment.chunks.is_null()) {
+            if (cached != index) {
+                block = read_segment_column(metadata, file, group_index, segment, column_index);
+                cached = index;
+            }
+            return block[local];
+        }
+        float slot;
+        file.seekg(segment.offset + (local * num_columns + column_index) * sizeof(float));
+        file.read(reinterpret_cast<char*>(&slot), sizeof(slot));
+        return load_value(slot, is_int);
+    };
+
+    long long low = 0, high = num_rows;
+    while (low < high) {
+        long long middle = low + (high - low) / 2;
+        if (reached(value_at(middle))) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Finds the positions of a sorted sequence matching a filter
+ *
+ * The matches of any filter on non-decreasing values form one range of
+ * positions (all but one range for NOT_EQUAL), found with at most two
+ * binary searches.
+ *
  * @param[in] operation Filter operation to apply
  * @param[in] filter_value Value to compare against
- * @return true if value passes filter, false otherwise
+ * @param[in] count Number of values
+ * @param[in] find Binary search returning the first position whose value
+ *            satisfies a predicate, false for a prefix and true after
+ * @return Range [first, last) of matches; NOT_EQUAL matches outside it
  */
-bool apply_filter(float value, int operation, float filter_value) {
-    const float EPSILON = 1e-6f;
+std::pair<long long, long long> sorted_match_range(
+        int operation, float filter_value, long long count,
+        const std::function<long long(const std::function<bool(float)>&)>& find) {
+    auto above = [&](float value) {
+        return value > filter_value && !apply_filter(value, EQUAL, filter_value);
+    };
+
+    long long first = 0, last = count;
     switch (operation) {
         case GREATER_THAN:
-            return value > filter_value;
+            first = find([&](float value) { return value > filter_value; });
+            break;
         case GREATER_EQUAL:
-            return value >= filter_value;
+            first = find([&](float value) { return value >= filter_value; });
+            break;
         case LESS_THAN:
-            return value < filter_value;
+            last = find([&](float value) { return value >= filter_value; });
+            break;
         case LESS_EQUAL:
-            return value <= filter_value;
+            last = find([&](float value) { return value > filter_value; });
+            break;
         case EQUAL:
-            return std::abs(value - filter_value) < EPSILON;
         case NOT_EQUAL:
-            return std::abs(value - filter_value) >= EPSILON;
+            // Values within the epsilon of the filter value sit between the two bounds
+            first = find([&](float value) {
+                return value > filter_value || apply_filter(value, EQUAL, filter_value);
+            });
+            last = find(above);
+            break;
         default:
-            return false;
+            last = 0;
+            break;
     }
+    return {first, last};
 }
 
 /**
- * @brief Filters data based on a condition
+ * @brief Selects the rows of a sorted column matching a filter
  * @param[in] metadata JSON metadata of the HTY file
- * @param[in] hty_file_path Path to the HTY file
- * @param[in] filtered_column Name of the column to filter
+ * @param[in] file Open HTY file
+ * @param[in] group_index Index of the column's group
+ * @param[in] column_index Index of the column within its group
  * @param[in] operation Filter operation to apply
- * @param[in] filtered_value Value to filter against
- * @return Vector of filtered values
+ * @param[in] filter_value Value to compare against
+ * @param[in,out] selection Bitmap receiving a set bit per matching row
  */
-std::vector<float> filter(const json& metadata,
-                         const std::string& hty_file_path,
-                         const std::string& filtered_column,
-                         int operation,
-                         float filtered_value) {
-    std::vector<float> result;
-    
-    // Get all values from the column
-    auto column_data = project_single_column(metadata, hty_file_path, filtered_column);
-    if (column_data.empty()) {
-        return result;
-    }
-    
-    // Apply filter
-    for (const auto& value : column_data) {
-        if (apply_filter(value, operation, filtered_value)) {
-            result.push_back(value);
-        }
+void select_sorted_range(const json& metadata, std::istream& file, int group_index,
+                         int column_index, int operation, float filter_value,
+                         std::vector<uint64_t>& selection) {
+    long long num_rows = metadata["num_rows"].get<long long>();
+    auto [first, last] = sorted_match_range(
+        operation, filter_value, num_rows, [&](const std::function<bool(float)>& reached) {
+            return find_first_row(metadata, file, group_index, column_index, reached);
+        });
+
+    if (operation == NOT_EQUAL) {
+        set_bits(selection, 0, first);
+        set_bits(selection, last, num_rows);
+    } else {
+        set_bits(selection, first, last);
     }
-    
-    return result;
 }
 
 /**
- * @brief Verifies if all columns are in the same group
+ * @brief Names an index file of a column
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column_name Name of the indexed column
+ * @param[in] suffix INDEX_SUFFIX or BITMAP_INDEX_SUFFIX
+ * @return Path of the sidecar next to the HTY file
+ */
+std::string index_path(const std::string& hty_file_path, const std::string& column_name,
+                       const char* suffix = INDEX_SUFFIX) {
+    std::string name = column_name;
+    std::replace(name.begin(), name.end(), '/', '_');
+    return hty_file_path + "." + name + suffix;
+}
+
+/**
+ * @brief Answers a filter from a column's bitmap index
+ *
+ * The filter is evaluated once per distinct value, and the bitmaps of the
+ * matching values are ORed into the selection without reading the column.
+ *
  * @param[in] metadata JSON metadata of the HTY file
- * @param[in] columns Vector of column names to check
- * @return Group index if all columns are in same group, -1 otherwise
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column_name Name of the filtered column
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @param[in,out] selection Bitmap receiving a set bit per matching indexed row
+ * @param[out] covered Number of leading rows the index answered for
+ * @return true if the index was used
  */
-int verify_same_group(const json& metadata, const std::vector<std::string>& columns) {
-    if (columns.empty()) return -1;
+bool lookup_bitmap_index(const json& metadata, const std::string& hty_file_path,
+                         const std::string& column_name, int operation, float filter_value,
+                         std::vector<uint64_t>& selection, long long& covered) {
+    std::ifstream index(index_path(hty_file_path, column_name, BITMAP_INDEX_SUFFIX),
+                        std::ios::binary);
+    BitmapIndexHeader header;
+    if (!index.is_open() || !index.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, BITMAP_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.file_id != metadata.value("file_id", 0ULL) ||
+        header.generation != metadata.value("generation", 0ULL) ||
+        header.num_rows > metadata["num_rows"].get<uint64_t>()) {
+        return false;
+    }
 
-    auto [first_group, first_col] = get_column_info(metadata, columns[0]);
-    if (first_group == -1) return -1;
+    // Bound the on-disk counts by the file before allocating for them
+    index.seekg(0, std::ios::end);
+    uint64_t index_size = index.tellg();
+    uint64_t values_offset = sizeof(header) + static_cast<uint64_t>(header.name_size);
+    if (values_offset > index_size ||
+        header.num_values > (index_size - values_offset) / sizeof(BitmapIndexValue)) {
+        std::cerr << "Error: Corrupt bitmap index for column " << column_name << std::endl;
+        return false;
+    }
 
-    for (size_t i = 1; i < columns.size(); ++i) {
-        if (columns[i].empty()) {
-            std::cerr << "Error: Empty column name at index " << i << std::endl;
-            return -1;
+    std::vector<BitmapIndexValue> values(header.num_values);
+    index.seekg(values_offset);
+    index.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(BitmapIndexValue));
+    std::string bytes;
+    for (const auto& value : values) {
+        if (!index || !apply_filter(value.value, operation, filter_value)) {
+            continue;
         }
-        auto [group_idx, col_idx] = get_column_info(metadata, columns[i]);
-        if (group_idx == -1 || group_idx != first_group) {
-            return -1;
+        if (value.offset > index_size || value.size > index_size - value.offset) {
+            std::cerr << "Error: Corrupt bitmap index for column " << column_name << std::endl;
+            std::fill(selection.begin(), selection.end(), 0);
+            return false;
+        }
+        bytes.resize(value.size);
+        index.seekg(value.offset);
+        index.read(bytes.data(), bytes.size());
+        if (!index || !roaring_or_into(bytes, selection)) {
+            std::cerr << "Error: Corrupt bitmap index for column " << column_name << std::endl;
+            std::fill(selection.begin(), selection.end(), 0);
+            return false;
         }
     }
-
-    return first_group;
+    if (!index) {
+        return false;
+    }
+    covered = header.num_rows;
+    return true;
 }
 
 /**
- * @brief Projects multiple columns from the HTY file
+ * @brief Looks up a filter in a column's secondary index
+ *
+ * The fence keys locate the one page each bound falls in, so finding the
+ * matching entries reads two pages, after which their count is known
+ * exactly. The lookup then only goes ahead if it returns at most
+ * INDEX_MAX_SELECTIVITY of the indexed rows; otherwise scanning the column
+ * is cheaper than reading the entries and the caller scans. Indexes built
+ * on another file or an earlier generation of this one are ignored.
+ *
  * @param[in] metadata JSON metadata of the HTY file
  * @param[in] hty_file_path Path to the HTY file
- * @param[in] projected_columns Names of the columns to project
- * @return Vector of vectors containing the projected column values
+ * @param[in] column_name Name of the filtered column
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @param[in,out] selection Bitmap receiving a set bit per matching indexed row
+ * @param[out] covered Number of leading rows the index answered for
+ * @return true if the index was used
  */
-std::vector<std::vector<float>> project(const json& metadata,
-                                      const std::string& hty_file_path,
-                                      const std::vector<std::string>& projected_columns) {
-    std::vector<std::vector<float>> result;
-    
-    // Verify all columns are in the same group
-    int group_index = verify_same_group(metadata, projected_columns);
-    if (group_index == -1) {
-        return result;
+bool lookup_index(const json& metadata, const std::string& hty_file_path,
+                  const std::string& column_name, int operation, float filter_value,
+                  std::vector<uint64_t>& selection, long long& covered) {
+    std::ifstream index(index_path(hty_file_path, column_name), std::ios::binary);
+    IndexHeader header;
+    if (!index.is_open() || !index.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.file_id != metadata.value("file_id", 0ULL) ||
+        header.generation != metadata.value("generation", 0ULL) ||
+        header.num_rows > metadata["num_rows"].get<uint64_t>() || header.page_entries == 0 ||
+        std::isnan(filter_value)) {
+        return false;
     }
-    
-    // Open file
-    std::ifstream file(hty_file_path, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
-        return result;
+
+    long long entries_offset = sizeof(header) + header.name_size;
+    long long num_entries = header.num_entries;
+    long long num_pages = (num_entries + header.page_entries - 1) / header.page_entries;
+    std::vector<float> fences(num_pages);
+    index.seekg(entries_offset + num_entries * static_cast<long long>(sizeof(IndexEntry)));
+    index.read(reinterpret_cast<char*>(fences.data()), fences.size() * sizeof(float));
+
+    std::vector<IndexEntry> page;
+    auto find = [&](const std::function<bool(float)>& reached) {
+        // The first match is in the page before the first fence that matches
+        long long next = std::partition_point(fences.begin(), fences.end(),
+                                              [&](float fence) { return !reached(fence); }) -
+                         fences.begin();
+        if (next == 0) {
+            return 0LL;
+        }
+        long long start = (next - 1) * header.page_entries;
+        page.resize(std::min<long long>(header.page_entries, num_entries - start));
+        index.seekg(entries_offset + start * static_cast<long long>(sizeof(IndexEntry)));
+        index.read(reinterpret_cast<char*>(page.data()), page.size() * sizeof(IndexEntry));
+        return start + (std::partition_point(page.begin(), page.end(),
+                                             [&](const IndexEntry& entry) {
+                                                 return !reached(entry.value);
+                                             }) - page.begin());
+    };
+    auto [first, last] = sorted_match_range(operation, filter_value, num_entries, find);
+    if (!index) {
+        return false;
     }
-    
+
+    // Plan: the index only pays off for selective filters
+    long long matches = operation == NOT_EQUAL ? num_entries - (last - first) : last - first;
+    if (matches > INDEX_MAX_SELECTIVITY * static_cast<double>(header.num_rows)) {
+        return false;
+    }
+
+    std::vector<std::pair<long long, long long>> ranges = {{first, last}};
+    if (operation == NOT_EQUAL) {
+        ranges = {{0, first}, {last, num_entries}};
+    }
+    std::vector<IndexEntry> entries;
+    for (auto [begin, end] : ranges) {
+        entries.resize(std::max(0LL, end - begin));
+        index.seekg(entries_offset + begin * static_cast<long long>(sizeof(IndexEntry)));
+        index.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(IndexEntry));
+        if (!index) {
+            return false;
+        }
+        for (const auto& entry : entries) {
+            selection[entry.row / 64] |= 1ULL << (entry.row % 64);
+        }
+    }
+    covered = header.num_rows;
+    return true;
+}
+
+/**
+ * @brief Checks a chunk's Bloom filter for values
+ *
+ * Reads only the 32-byte filter block each value falls in.
+ *
+ * @param[in] file Open HTY file
+ * @param[in] chunk Chunk entry of the segment
+ * @param[in] probes Values to look up
+ * @return true if the chunk has a Bloom filter and holds none of the values
+ */
+bool bloom_excludes(std::istream& file, const json& chunk, const std::vector<float>& probes) {
+    if (!chunk.contains("bloom_offset")) {
+        return false;
+    }
+    size_t num_blocks = chunk["bloom_blocks"].get<size_t>();
+    uint32_t block[BLOOM_BLOCK_WORDS];
+    for (float probe : probes) {
+        uint64_t hash = bloom_hash(probe);
+        file.seekg(chunk["bloom_offset"].get<long long>() +
+                   static_cast<long long>(bloom_block(hash, num_blocks) * sizeof(block)));
+        file.read(reinterpret_cast<char*>(block), sizeof(block));
+        if (bloom_check(block, hash)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Estimates how many rows pass a filter from the column's statistics
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] group_index Index of the column's group
+ * @param[in] column_index Index of the column within its group
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @return Estimated number of matching rows, -1 if the column has no statistics
+ */
+long long estimate_matches(const json& metadata, int group_index, int column_index,
+                           int operation, float filter_value) {
+    const auto& column = metadata["groups"][group_index]["columns"][column_index];
+    if (!column.contains("stats")) {
+        return -1;
+    }
+    return std::llround(estimate_selectivity(column["stats"], operation, filter_value) *
+                        metadata["num_rows"].get<double>());
+}
+
+/**
+ * @brief Evaluates a filter over a column into a selection bitmap
+ *
+ * Columnar blocks are filtered by the chunk kernels, which work on the
+ * encoded values; row-major segments are read and compared row by row.
+ * EQUAL filters skip blocks whose Bloom filter rules the value out
+ * without reading them. Columns marked sorted are not scanned at all: the
+ * matching rows are found by binary search. Otherwise a bitmap index, or
+ * a secondary index if the filter is selective enough, answers for the
+ * rows it covers and only rows appended since are scanned. Column
+ * statistics, when present, skip probing the secondary index for filters
+ * they estimate to be far too wide for it. Segments whose zone map shows
+ * that no value passes are skipped, and those where every value passes
+ * are selected whole, reading at most a validity bitmap.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @param[in] hty_file_path Path to the HTY file, used to find its indexes
+ * @param[in] group_index Index of the column's group
+ * @param[in] column_index Index of the column within its group
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @param[out] matched If not null, receives the matching values of every
+ *             segment that was scanned, in row order, keyed by its first row
+ * @return Bitmap with a set bit per matching row
+ */
+std::vector<uint64_t> evaluate_filter(const json& metadata, std::istream& file,
+                                      const std::string& hty_file_path,
+                                      int group_index, int column_index,
+                                      int operation, float filter_value,
+                                      std::map<long long, std::vector<float>>* matched = nullptr) {
+    std::vector<uint64_t> selection(bitmap_words(metadata["num_rows"].get<long long>()), 0);
+    const auto& column = metadata["groups"][group_index]["columns"][column_index];
+    if (column.value("sorted", false) && !std::isnan(filter_value)) {
+        select_sorted_range(metadata, file, group_index, column_index, operation, filter_value,
+                            selection);
+        return selection;
+    }
+
+    // Indexed rows end on a segment boundary, since rows are added a segment at a time
+    std::vector<Segment> segments = get_group_segments(metadata, group_index);
+    long long covered = 0;
+    // Statistics rule out the secondary index for clearly unselective filters without
+    // probing it; estimates are approximate, so borderline ones still ask the index
+    long long estimate = estimate_matches(metadata, group_index, column_index, operation,
+                                          filter_value);
+    bool try_index = estimate < 0 || estimate <= 2 * INDEX_MAX_SELECTIVITY *
+                                                 metadata["num_rows"].get<double>();
+    if (lookup_bitmap_index(metadata, hty_file_path, column["column_name"], operation,
+                            filter_value, selection, covered) ||
+        (try_index && lookup_index(metadata, hty_file_path, column["column_name"], operation,
+                                   filter_value, selection, covered))) {
+        long long boundary = 0;
+        for (size_t i = 0; i < segments.size() && boundary < covered; ++i) {
+            boundary += segments[i].num_rows;
+        }
+        if (boundary != covered) {
+            std::fill(selection.begin(), selection.end(), 0);
+            covered = 0;
+        }
+    }
+
+    bool is_int = is_int_column(column);
+    std::vector<float> probes;
+    bool use_bloom = operation == EQUAL && bloom_probes(filter_value, is_int, probes);
+    long long segment_start = 0;
+    auto keep_matches = [&](const Segment& segment, const std::vector<float>& values) {
+        auto& kept = (*matched)[segment_start];
+        for (int i = 0; i < segment.num_rows; ++i) {
+            if (test_bit(selection, segment_start + i)) {
+                kept.push_back(values[i]);
+            }
+        }
+    };
+    for (const auto& segment : segments) {
+        if (segment_start < covered) {
+            segment_start += segment.num_rows;
+            continue;
+        }
+        ZoneMap zone = segment_zone(segment, column_index);
+        int verdict = zone_verdict(zone, operation, filter_value);
+        // Row-major segments with nulls are still scanned to find them
+        bool whole = verdict == 1 && (zone.null_count == 0 || !segment.chunks.is_null());
+        if (whole) {
+            set_bits(selection, segment_start, segment_start + segment.num_rows);
+            if (zone.null_count > 0) {
+                and_validity(selection, segment_start,
+                             read_validity(file, segment.chunks[column_index],
+                                           segment.num_rows),
+                             segment.num_rows);
+            }
+        }
+        if (verdict == 0 || whole) {
+            segment_start += segment.num_rows;
+            continue;
+        }
+        if (!segment.chunks.is_null()) {
+            const auto& chunk = segment.chunks[column_index];
+            if (use_bloom && bloom_excludes(file, chunk, probes)) {
+                segment_start += segment.num_rows;
+                continue;
+            }
+            std::string bytes = read_chunk(file, chunk);
+            filter_chunk(chunk, bytes, segment.num_rows, is_int, operation, filter_value,
+                         selection, segment_start, read_validity(file, chunk, segment.num_rows));
+            // Nulls never match, so the decoded values need no validity
+            if (matched != nullptr) {
+                keep_matches(segment, decode_chunk(chunk, bytes, segment.num_rows, is_int));
+            }
+        } else {
+            auto values = read_segment_column(metadata, file, group_index, segment,
+                                              column_index);
+            for (int i = 0; i < segment.num_rows; ++i) {
+                uint64_t match = apply_filter(values[i], operation, filter_value);
+                long long bit = segment_start + i;
+                selection[bit / 64] |= match << (bit % 64);
+            }
+            if (matched != nullptr) {
+                keep_matches(segment, values);
+            }
+        }
+        segment_start += segment.num_rows;
+    }
+    return selection;
+}
+
+/**
+ * @brief Reads a whole byte range at a file offset, retrying short reads
+ * @param[in] fd File descriptor to read from
+ * @param[out] data Buffer receiving the bytes
+ * @param[in] size Number of bytes to read
+ * @param[in] offset File offset of the first byte
+ * @return true on success, false on an error or end of file
+ */
+bool read_all(int fd, char* data, size_t size, long long offset) {
+    while (size > 0) {
+        ssize_t bytes_read = pread(fd, data, size, offset);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return false;
+        }
+        data += bytes_read;
+        size -= bytes_read;
+        offset += bytes_read;
+    }
+    return true;
+}
+
+/**
+ * @brief Costs of the storage an HTY file lives on
+ */
+struct IoCost {
+    double seek_micros;         // Latency of one small random read
+    double bytes_per_micro;     // Sequential read bandwidth
+
+    /**
+     * @brief Gap between two reads below which reading through it beats a second read
+     * @return Break-even gap in bytes
+     */
+    long long coalesce_gap() const {
+        return static_cast<long long>(seek_micros * bytes_per_micro);
+    }
+};
+
+/**
+ * @brief Loads the I/O costs measured by calibrate_io_cost
+ * @param[in] hty_file_path Path to the HTY file
+ * @return Measured costs, or the defaults if the file was never calibrated
+ */
+IoCost load_io_cost(const std::string& hty_file_path) {
+    IoCost cost = {IO_SEEK_MICROS, IO_BYTES_PER_MICRO};
+    std::ifstream input(hty_file_path + IO_COST_SUFFIX);
+    json measured = json::parse(input, nullptr, false);
+    if (input.is_open() && measured.is_object() && measured.value("seek_micros", 0.0) > 0 &&
+        measured.value("bytes_per_micro", 0.0) > 0) {
+        cost = {measured["seek_micros"].get<double>(), measured["bytes_per_micro"].get<double>()};
+    }
+    return cost;
+}
+
+/**
+ * @brief Measures the I/O costs of the storage under an HTY file
+ *
+ * Drops the file from the page cache, then times a sequential read of up
+ * to CALIBRATE_SEQUENTIAL_BYTES and CALIBRATE_SEEKS small reads at
+ * scattered offsets. The result is written next to the file for
+ * load_io_cost.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[out] cost Measured costs
+ * @return true on success, false otherwise
+ */
+bool calibrate_io_cost(const std::string& hty_file_path, IoCost& cost) {
+    int fd = open(hty_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        std::cerr << "Error: Unable to read size of " << hty_file_path << std::endl;
+        close(fd);
+        return false;
+    }
+    if (file_stat.st_size < CALIBRATE_MIN_BYTES) {
+        std::cerr << "Error: File too small to calibrate: " << hty_file_path << std::endl;
+        close(fd);
+        return false;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto micros_since = [](clock::time_point start) {
+        return std::max(1.0, std::chrono::duration<double, std::micro>(clock::now() - start)
+                                 .count());
+    };
+    std::vector<char> buffer(1 << 20);
+    bool success = true;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    long long sequential = std::min<long long>(file_stat.st_size, CALIBRATE_SEQUENTIAL_BYTES);
+    auto start = clock::now();
+    for (long long offset = 0; offset < sequential && success; offset += buffer.size()) {
+        success = read_all(fd, buffer.data(),
+                           std::min<long long>(buffer.size(), sequential - offset), offset);
+    }
+    cost.bytes_per_micro = sequential / micros_since(start);
+
+    // Offsets spread over the whole file, a page each, in no particular order
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    long long pages = file_stat.st_size / CALIBRATE_READ_BYTES;
+    start = clock::now();
+    for (long long i = 0; i < CALIBRATE_SEEKS && success; ++i) {
+        long long page = (i * 2654435761LL) % pages;
+        success = read_all(fd, buffer.data(), CALIBRATE_READ_BYTES, page * CALIBRATE_READ_BYTES);
+    }
+    cost.seek_micros = micros_since(start) / CALIBRATE_SEEKS;
+    close(fd);
+    if (!success) {
+        std::cerr << "Error: Unable to read " << hty_file_path << std::endl;
+        return false;
+    }
+
+    std::string path = hty_file_path + IO_COST_SUFFIX;
+    std::ofstream output(path + REWRITE_TMP_SUFFIX);
+    output << json{{"seek_micros", cost.seek_micros},
+                   {"bytes_per_micro", cost.bytes_per_micro}}.dump() << std::endl;
+    output.close();
+    if (!output || rename((path + REWRITE_TMP_SUFFIX).c_str(), path.c_str()) != 0) {
+        std::cerr << "Error: Unable to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the selected rows of a block laid out at a fixed stride
+ *
+ * Compares the cost of one sequential read spanning every selected row
+ * with that of one read per run of consecutive selected rows, and does
+ * the cheaper. Sparse selections thus read only their rows, and dense
+ * ones read the block in a single pass.
+ *
+ * @param[in] fd Open HTY file
+ * @param[in] cost I/O costs of the file's storage
+ * @param[in] base Offset of the block's first row
+ * @param[in] stride Bytes from one row to the next
+ * @param[in] width Bytes to read from the start of each row
+ * @param[in] selection Bitmap of the rows to read
+ * @param[in] first_row Row number of the block's first row
+ * @param[in] num_rows Number of rows in the block
+ * @param[in] emit Called in row order with each selected row, within the block, and its bytes
+ * @return true on success, false on a read error
+ */
+bool read_strided(int fd, const IoCost& cost, long long base, long long stride,
+                  long long width, const std::vector<uint64_t>& selection,
+                  long long first_row, long long num_rows,
+                  const std::function<void(long long, const char*)>& emit) {
+    std::vector<std::pair<long long, long long>> runs;   // [first, last) rows of the block
+    long long selected = 0;
+    for (long long row = 0; row < num_rows; ++row) {
+        if (!test_bit(selection, first_row + row)) {
+            continue;
+        }
+        if (!runs.empty() && runs.back().second == row) {
+            ++runs.back().second;
+        } else {
+            runs.push_back({row, row + 1});
+        }
+        ++selected;
+    }
+    if (runs.empty()) {
+        return true;
+    }
+
+    long long span = (runs.back().second - 1 - runs.front().first) * stride + width;
+    long long targeted_bytes = (selected - static_cast<long long>(runs.size())) * stride +
+                               static_cast<long long>(runs.size()) * width;
+    double bulk_cost = cost.seek_micros + span / cost.bytes_per_micro;
+    double targeted_cost = runs.size() * cost.seek_micros + targeted_bytes / cost.bytes_per_micro;
+    if (bulk_cost <= targeted_cost) {
+        runs = {{runs.front().first, runs.back().second}};
+    }
+
+    std::string buffer;
+    for (const auto& [first, last] : runs) {
+        buffer.resize((last - 1 - first) * stride + width);
+        if (!read_all(fd, buffer.data(), buffer.size(), base + first * stride)) {
+            return false;
+        }
+        for (long long row = first; row < last; ++row) {
+            if (test_bit(selection, first_row + row)) {
+                emit(row, buffer.data() + (row - first) * stride);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Reads selected rows of some columns of a group
+ *
+ * Row-major segments, in windows of HTY_BLOCK_ROWS rows, and raw
+ * uncompressed columnar chunks are read through read_strided, which picks
+ * per block between a bulk read and reads of just the selected rows.
+ * Other chunks must be decoded whole and are read in bulk.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] file Open HTY file
+ * @param[in] hty_file_path Path to the HTY file, used to find its I/O costs
+ * @param[in] group_index Index of the group holding the columns
+ * @param[in] column_indices Indices of the columns within the group
+ * @param[in] selection Bitmap of the rows to read
+ * @param[out] result One vector per column with the selected values in row order
+ * @return true on success, false if the rows could not be read
+ */
+bool gather_rows(const json& metadata, const Snapshot& snapshot, std::istream& file,
+                 const std::string& hty_file_path,
+                 int group_index, const std::vector<int>& column_indices,
+                 const std::vector<uint64_t>& selection,
+                 std::vector<std::vector<float>>& result) {
+    result.assign(column_indices.size(), {});
     const auto& group = metadata["groups"][group_index];
-    int num_rows = metadata["num_rows"];
-    int offset = group["offset"];
     int num_columns = group["num_columns"];
-    
-    // Initialize result vectors
-    result.resize(projected_columns.size(), std::vector<float>(num_rows));
-    
-    // Get column indices
-    std::vector<int> column_indices;
-    for (const auto& col_name : projected_columns) {
-        auto [_, col_idx] = get_column_info(metadata, col_name);
-        column_indices.push_back(col_idx);
+
+    // The selection gives the exact result size, so no vector grows while filling
+    size_t num_selected = 0;
+    for (uint64_t word : selection) {
+        num_selected += __builtin_popcountll(word);
     }
-    
-    // Read data for each row
-    for (int row = 0; row < num_rows; ++row) {
+    for (auto& values : result) {
+        values.reserve(num_selected);
+    }
+    if (num_selected == 0 || column_indices.empty()) {
+        return true;
+    }
+
+    int fd = open(snapshot_path(snapshot, hty_file_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
+    }
+    IoCost cost = load_io_cost(hty_file_path);
+    std::vector<bool> int_columns;
+    for (int col : column_indices) {
+        int_columns.push_back(is_int_column(group["columns"][col]));
+    }
+
+    // Row-major reads cover the selected columns' span of each row
+    int min_column = *std::min_element(column_indices.begin(), column_indices.end());
+    int max_column = *std::max_element(column_indices.begin(), column_indices.end());
+    long long row_size = num_columns * sizeof(float);
+    auto emit_row = [&](long long, const char* row) {
         for (size_t i = 0; i < column_indices.size(); ++i) {
-            int col_idx = column_indices[i];
-            file.seekg(offset + (row * num_columns + col_idx) * sizeof(float));
-            file.read(reinterpret_cast<char*>(&result[i][row]), sizeof(float));
+            float slot;
+            std::memcpy(&slot, row + (column_indices[i] - min_column) * sizeof(float),
+                        sizeof(slot));
+            result[i].push_back(load_value(slot, int_columns[i]));
+        }
+    };
+
+    bool success = true;
+    long long segment_start = 0;
+    for (const auto& segment : get_group_segments(metadata, group_index)) {
+        long long segment_end = segment_start + segment.num_rows;
+        if (segment.chunks.is_null()) {
+            for (long long window = 0; window < segment.num_rows && success;
+                 window += HTY_BLOCK_ROWS) {
+                success = read_strided(fd, cost,
+                                       segment.offset + window * row_size +
+                                           min_column * sizeof(float),
+                                       row_size, (max_column - min_column + 1) * sizeof(float),
+                                       selection, segment_start + window,
+                                       std::min<long long>(HTY_BLOCK_ROWS,
+                                                           segment.num_rows - window),
+                                       emit_row);
+            }
+            segment_start = segment_end;
+            continue;
+        }
+
+        bool any_selected = false;
+        for (long long row = segment_start; row < segment_end && !any_selected; ++row) {
+            any_selected = test_bit(selection, row);
+        }
+        for (size_t i = 0; i < column_indices.size() && any_selected && success; ++i) {
+            const auto& chunk = segment.chunks[column_indices[i]];
+            if (chunk["encoding"] == "raw" && !chunk.contains("compression")) {
+                auto validity = read_validity(file, chunk, segment.num_rows);
+                success = read_strided(fd, cost, chunk["offset"].get<long long>(),
+                                       sizeof(float), sizeof(float), selection,
+                                       segment_start, segment.num_rows,
+                                       [&](long long row, const char* data) {
+                    float slot;
+                    std::memcpy(&slot, data, sizeof(slot));
+                    bool valid = validity.empty() || test_bit(validity, row);
+                    result[i].push_back(valid ? load_value(slot, int_columns[i]) : NAN);
+                });
+                continue;
+            }
+
+            auto values = read_segment_column(metadata, file, group_index, segment,
+                                              column_indices[i]);
+            for (long long row = segment_start; row < segment_end; ++row) {
+                if (test_bit(selection, row)) {
+                    result[i].push_back(values[row - segment_start]);
+                }
+            }
         }
+        segment_start = segment_end;
+    }
+    close(fd);
+    if (!success) {
+        std::cerr << "Error: Unable to read rows from " << hty_file_path << std::endl;
+    }
+    return success;
+}
+
+/**
+ * @brief One stored value to read for fetch_rows
+ */
+struct FetchRead {
+    long long offset;           // Offset of the 4-byte slot
+    long long validity_offset;  // Offset of the validity word covering the row, -1 if none
+    int validity_bit;           // Bit of the row in that word
+    size_t column;              // Position of the column in the request
+    size_t row;                 // Position of the row in the request
+    bool is_int;
+};
+
+/**
+ * @brief Fetches some rows of some columns by row id
+ *
+ * Values that sit at a fixed stride (row-major segments and raw,
+ * uncompressed columnar chunks) are read in place. Their byte ranges are
+ * sorted and merged when the gap between them is cheaper to read through
+ * than a second read would be (IoCost::coalesce_gap), so nearby ids share
+ * one pread. The kernel is told about the
+ * next FETCH_PREFETCH_RANGES ranges ahead of reading them, so scattered
+ * ids are fetched concurrently rather than one seek at a time. Encoded
+ * and compressed chunks are prefetched the same way, then decoded once
+ * per block whatever the number of ids falling in it.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column_names Names of the columns to fetch
+ * @param[in] row_ids Ids of live rows, ascending
+ * @return One vector per column with a value per row id, empty on failure
+ */
+std::vector<std::vector<float>> fetch_rows(const json& metadata, const Snapshot& snapshot,
+                                           const std::string& hty_file_path,
+                                           const std::vector<std::string>& column_names,
+                                           const std::vector<long long>& row_ids) {
+    long long num_rows = metadata["num_rows"].get<long long>();
+    for (size_t i = 0; i < row_ids.size(); ++i) {
+        if (row_ids[i] < 0 || row_ids[i] >= num_rows || (i > 0 && row_ids[i] < row_ids[i - 1])) {
+            std::cerr << "Error: Row ids must be ascending and below " << num_rows << std::endl;
+            return {};
+        }
+    }
+
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    int fd = open(snapshot_path(snapshot, hty_file_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (!file.is_open() || fd < 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return {};
+    }
+    auto live = load_live_rows(metadata, file);
+    for (long long row : row_ids) {
+        if (!live.empty() && !test_bit(live, row)) {
+            std::cerr << "Error: Row " << row << " is deleted" << std::endl;
+            close(fd);
+            return {};
+        }
+    }
+
+    // Plan the reads: slots read in place, and blocks that must be decoded
+    struct FetchDecode {
+        int group_index;
+        Segment segment;
+        long long segment_start;
+        int column_index;
+        size_t column;
+        size_t first, last;     // Positions of the block's rows in the request
+    };
+    std::vector<FetchRead> reads;
+    std::vector<FetchDecode> decodes;
+    for (size_t c = 0; c < column_names.size(); ++c) {
+        auto [group_index, column_index] = get_column_info(metadata, column_names[c]);
+        if (group_index == -1) {
+            close(fd);
+            return {};
+        }
+        const auto& group = metadata["groups"][group_index];
+        bool is_int = is_int_column(group["columns"][column_index]);
+        long long row_stride = group["num_columns"].get<long long>() * sizeof(float);
+
+        long long segment_start = 0;
+        size_t i = 0;
+        for (const auto& segment : get_group_segments(metadata, group_index)) {
+            long long segment_end = segment_start + segment.num_rows;
+            size_t first = i;
+            while (i < row_ids.size() && row_ids[i] < segment_end) {
+                ++i;
+            }
+
+            long long base = segment.offset + column_index * sizeof(float);
+            long long stride = row_stride;
+            long long validity_offset = -1;
+            if (first < i && !segment.chunks.is_null()) {
+                const auto& chunk = segment.chunks[column_index];
+                if (chunk["encoding"] != "raw" || chunk.contains("compression")) {
+                    decodes.push_back({group_index, segment, segment_start, column_index, c,
+                                       first, i});
+                    first = i;
+                }
+                base = chunk["offset"].get<long long>();
+                stride = sizeof(float);
+                if (chunk.value("null_count", 0) > 0) {
+                    validity_offset = chunk["validity_offset"].get<long long>();
+                }
+            }
+            for (size_t k = first; k < i; ++k) {
+                long long row = row_ids[k] - segment_start;
+                reads.push_back({base + row * stride,
+                                 validity_offset < 0 ? -1 : validity_offset +
+                                     row / 64 * static_cast<long long>(sizeof(uint64_t)),
+                                 static_cast<int>(row % 64), c, k, is_int});
+            }
+            segment_start = segment_end;
+        }
+    }
+
+    // Merge the slots into ranges, nearby ones into the same range
+    long long coalesce_gap = load_io_cost(hty_file_path).coalesce_gap();
+    std::vector<std::pair<long long, long long>> extents;
+    for (const auto& read : reads) {
+        extents.push_back({read.offset, read.offset + sizeof(float)});
+        if (read.validity_offset >= 0) {
+            extents.push_back({read.validity_offset, read.validity_offset + sizeof(uint64_t)});
+        }
+    }
+    std::sort(extents.begin(), extents.end());
+    std::vector<std::pair<long long, long long>> ranges;
+    for (const auto& extent : extents) {
+        if (!ranges.empty() && extent.first - ranges.back().second <= coalesce_gap) {
+            ranges.back().second = std::max(ranges.back().second, extent.second);
+        } else {
+            ranges.push_back(extent);
+        }
+    }
+
+    // Announce ranges ahead of reading them, so scattered ones load in parallel
+    for (const auto& decode : decodes) {
+        const auto& chunk = decode.segment.chunks[decode.column_index];
+        posix_fadvise(fd, chunk["offset"].get<long long>(),
+                      chunk_extent(chunk, decode.segment.num_rows), POSIX_FADV_WILLNEED);
+    }
+    auto prefetch = [&](size_t r) {
+        if (r < ranges.size()) {
+            posix_fadvise(fd, ranges[r].first, ranges[r].second - ranges[r].first,
+                          POSIX_FADV_WILLNEED);
+        }
+    };
+    for (size_t r = 0; r < FETCH_PREFETCH_RANGES; ++r) {
+        prefetch(r);
+    }
+    std::vector<std::string> buffers(ranges.size());
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        prefetch(r + FETCH_PREFETCH_RANGES);
+        buffers[r].resize(ranges[r].second - ranges[r].first);
+        if (!read_all(fd, buffers[r].data(), buffers[r].size(), ranges[r].first)) {
+            std::cerr << "Error: Unable to read rows from " << hty_file_path << std::endl;
+            close(fd);
+            return {};
+        }
+    }
+    close(fd);
+
+    auto bytes_at = [&](long long offset) {
+        size_t r = std::upper_bound(ranges.begin(), ranges.end(),
+                                    std::make_pair(offset, LLONG_MAX)) - ranges.begin() - 1;
+        return buffers[r].data() + (offset - ranges[r].first);
+    };
+    std::vector<std::vector<float>> result(column_names.size(),
+                                           std::vector<float>(row_ids.size()));
+    for (const auto& read : reads) {
+        float slot;
+        std::memcpy(&slot, bytes_at(read.offset), sizeof(float));
+        float value = load_value(slot, read.is_int);
+        if (read.validity_offset >= 0) {
+            uint64_t word;
+            std::memcpy(&word, bytes_at(read.validity_offset), sizeof(word));
+            if (!(word >> read.validity_bit & 1)) {
+                value = NAN;
+            }
+        }
+        result[read.column][read.row] = value;
+    }
+    try {
+        for (const auto& decode : decodes) {
+            auto values = read_segment_column(metadata, file, decode.group_index, decode.segment,
+                                              decode.column_index);
+            for (size_t k = decode.first; k < decode.last; ++k) {
+                result[decode.column][k] = values[row_ids[k] - decode.segment_start];
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return {};
     }
-    
-    file.close();
     return result;
 }
 
 /**
- * @brief Projects columns and applies filter condition
+ * @brief Filters data based on a condition
  * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
  * @param[in] hty_file_path Path to the HTY file
- * @param[in] projected_columns Names of columns to project
- * @param[in] filtered_column Name of column to filter on
- * @param[in] op Filter operation to apply
- * @param[in] value Filter value to compare against
- * @return Vector of vectors containing filtered column values
- */
-std::vector<std::vector<float>> project_and_filter(const json& metadata,
-                                                 const std::string& hty_file_path,
-                                                 const std::vector<std::string>& projected_columns,
-                                                 const std::string& filtered_column,
-                                                 int op,
-                                                 float value) {
-    std::vector<std::vector<float>> result;
-    
-    // Create a combined vector of all columns we need
-    std::vector<std::string> all_columns = projected_columns;
-    if (std::find(all_columns.begin(), all_columns.end(), filtered_column) == all_columns.end()) {
-        all_columns.push_back(filtered_column);
+ * @param[in] filtered_column Name of the column to filter
+ * @param[in] operation Filter operation to apply
+ * @param[in] filtered_value Value to filter against
+ * @param[out] result Filtered values
+ * @return true on success, false otherwise
+ */
+bool filter(const json& metadata, const Snapshot& snapshot,
+            const std::string& hty_file_path,
+            const std::string& filtered_column,
+            int operation,
+            float filtered_value,
+            std::vector<float>& result) {
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
     }
-    
-    // Verify all columns are in the same group
-    int group_index = verify_same_group(metadata, all_columns);
+
+    auto [group_index, column_index] = get_column_info(metadata, filtered_column);
     if (group_index == -1) {
-        return result;
+        return false;
+    }
+
+    // Evaluate the filter over every stored row, then mask out deleted rows.
+    // Scanned segments hand back their matching values, so only the rows of
+    // segments answered without reading the column are gathered
+    std::map<long long, std::vector<float>> matched;
+    auto selection = evaluate_filter(metadata, file, hty_file_path, group_index, column_index,
+                                     operation, filtered_value, &matched);
+    std::vector<uint64_t> evaluated = selection;
+    auto live = load_live_rows(metadata, file);
+    if (!live.empty()) {
+        and_bitmaps(selection.data(), live.data(), selection.size());
+    }
+    std::vector<Segment> segments = get_group_segments(metadata, group_index);
+    std::vector<uint64_t> remaining = selection;
+    long long segment_start = 0;
+    for (const auto& segment : segments) {
+        if (matched.count(segment_start)) {
+            for (long long row = segment_start; row < segment_start + segment.num_rows; ++row) {
+                remaining[row / 64] &= ~(1ULL << (row % 64));
+            }
+        }
+        segment_start += segment.num_rows;
+    }
+    std::vector<std::vector<float>> columns;
+    if (!gather_rows(metadata, snapshot, file, hty_file_path, group_index, {column_index},
+                     remaining, columns)) {
+        return false;
+    }
+
+    // Merge both in row order, dropping scanned matches that were deleted
+    size_t num_selected = 0;
+    for (uint64_t word : selection) {
+        num_selected += __builtin_popcountll(word);
+    }
+    result.clear();
+    result.reserve(num_selected);
+    size_t next = 0;
+    segment_start = 0;
+    for (const auto& segment : segments) {
+        long long segment_end = segment_start + segment.num_rows;
+        auto scanned = matched.find(segment_start);
+        size_t kept = 0;
+        for (long long row = segment_start; row < segment_end; ++row) {
+            if (scanned == matched.end()) {
+                if (test_bit(selection, row)) {
+                    result.push_back(columns[0][next++]);
+                }
+            } else if (test_bit(evaluated, row)) {
+                if (test_bit(selection, row)) {
+                    result.push_back(scanned->second[kept]);
+                }
+                ++kept;
+            }
+        }
+        segment_start = segment_end;
+    }
+    
+    file.close();
+    return true;
+}
+
+/**
+ * @brief One predicate of a boolean filter expression
+ */
+struct Predicate {
+    bool combine_or;            // Joined to the predicates before it by OR rather than AND
+    bool negate;                // Preceded by NOT
+    std::string column;
+    int operation;
+    float value;
+};
+
+/**
+ * @brief Counts the live rows matching predicates joined by AND and OR
+ *
+ * Each predicate is evaluated into a row bitmap, through an index where
+ * the column has one, and the bitmaps are combined left to right with
+ * word-wise AND, OR and NOT. The count is a popcount of the result, so no
+ * column is read when every predicate is answered by an index.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] predicates Predicates in the order written
+ * @return Number of matching rows, -1 on failure
+ */
+long long count_matching(const json& metadata, const Snapshot& snapshot,
+                         const std::string& hty_file_path,
+                         const std::vector<Predicate>& predicates) {
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return -1;
+    }
+
+    long long num_rows = metadata["num_rows"].get<long long>();
+    std::vector<uint64_t> result;
+    for (const auto& predicate : predicates) {
+        auto [group_index, column_index] = get_column_info(metadata, predicate.column);
+        if (group_index == -1) {
+            return -1;
+        }
+        auto matches = evaluate_filter(metadata, file, hty_file_path, group_index,
+                                       column_index, predicate.operation, predicate.value);
+        if (predicate.negate) {
+            for (auto& word : matches) {
+                word = ~word;
+            }
+            if (num_rows % 64 != 0) {
+                matches.back() &= (1ULL << (num_rows % 64)) - 1;
+            }
+        }
+        if (result.empty()) {
+            result = std::move(matches);
+        } else if (predicate.combine_or) {
+            or_bitmaps(result.data(), matches.data(), result.size());
+        } else {
+            and_bitmaps(result.data(), matches.data(), result.size());
+        }
+    }
+
+    auto live = load_live_rows(metadata, file);
+    if (!live.empty()) {
+        and_bitmaps(result.data(), live.data(), result.size());
+    }
+    long long count = 0;
+    for (uint64_t word : result) {
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+/**
+ * @brief In-memory copy of a column reorganized by the range filters run on it
+ *
+ * Values are kept with their row ids and partially ordered: every crack
+ * key marks the position before which all values are smaller than the
+ * key and from which all are at least the key. Each filter cracks the
+ * pieces holding its bounds, so later filters partition ever smaller
+ * pieces and the copy converges towards a sorted column.
+ */
+struct CrackerColumn {
+    std::vector<float> values;
+    std::vector<uint32_t> rows;
+    std::map<float, size_t> cracks;     // Key -> first position whose value is >= key
+};
+
+/**
+ * @brief Copies the live, non-null rows of a column into a cracker column
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column_name Name of the column
+ * @param[out] column Cracker column to fill
+ * @return true on success, false otherwise
+ */
+bool load_cracker_column(const json& metadata, const Snapshot& snapshot,
+                         const std::string& hty_file_path,
+                         const std::string& column_name, CrackerColumn& column) {
+    auto [group_index, column_index] = get_column_info(metadata, column_name);
+    if (group_index == -1) {
+        return false;
+    }
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
+    }
+
+    auto values = read_column(metadata, file, group_index, column_index);
+    auto live = load_live_rows(metadata, file);
+    for (size_t row = 0; row < values.size(); ++row) {
+        if (!std::isnan(values[row]) && (live.empty() || test_bit(live, row))) {
+            column.values.push_back(values[row]);
+            column.rows.push_back(row);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Cracks the piece of a cracker column holding a key
+ *
+ * Partitions only that piece in place, smaller values first, and records
+ * the split so the same key is never partitioned again.
+ *
+ * @param[in,out] column Cracker column
+ * @param[in] key Value to crack on
+ * @return Position of the first value that is at least the key
+ */
+size_t crack(CrackerColumn& column, float key) {
+    auto next = column.cracks.lower_bound(key);
+    if (next != column.cracks.end() && next->first == key) {
+        return next->second;
+    }
+    size_t first = next == column.cracks.begin() ? 0 : std::prev(next)->second;
+    size_t last = next == column.cracks.end() ? column.values.size() : next->second;
+
+    while (true) {
+        while (first < last && column.values[first] < key) {
+            ++first;
+        }
+        while (first < last && !(column.values[last - 1] < key)) {
+            --last;
+        }
+        if (first >= last) {
+            break;
+        }
+        std::swap(column.values[first], column.values[last - 1]);
+        std::swap(column.rows[first], column.rows[last - 1]);
+    }
+    column.cracks[key] = first;
+    return first;
+}
+
+/**
+ * @brief Answers range filters from standard input, cracking as it goes
+ *
+ * Each line holds a column name and inclusive bounds. The first filter on
+ * a column copies it into memory, and every filter cracks the copy at its
+ * bounds and prints the values between them in row order. All filters see
+ * the file as it was when the session started.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @return true if every filter succeeded, false otherwise
+ */
+bool run_cracking_session(const json& metadata, const Snapshot& snapshot,
+                          const std::string& hty_file_path) {
+    std::map<std::string, CrackerColumn> columns;
+    std::string line;
+    bool success = true;
+    while (std::getline(std::cin, line)) {
+        std::istringstream query(line);
+        std::string column_name;
+        float low, high;
+        if (!(query >> column_name)) {
+            continue;
+        }
+        if (!(query >> low >> high)) {
+            std::cerr << "Error: Expected <column> <low> <high>: " << line << std::endl;
+            success = false;
+            continue;
+        }
+
+        auto found = columns.find(column_name);
+        if (found == columns.end()) {
+            CrackerColumn column;
+            if (!load_cracker_column(metadata, snapshot, hty_file_path, column_name, column)) {
+                success = false;
+                continue;
+            }
+            found = columns.emplace(column_name, std::move(column)).first;
+        }
+
+        // The upper crack falls just past high, so values equal to high are included
+        CrackerColumn& column = found->second;
+        size_t first = crack(column, low);
+        size_t last = std::max(first, crack(column, std::nextafter(high, INFINITY)));
+        std::vector<std::pair<uint32_t, float>> matches;
+        matches.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            matches.push_back({column.rows[i], column.values[i]});
+        }
+        std::sort(matches.begin(), matches.end());
+
+        std::vector<float> values;
+        values.reserve(matches.size());
+        for (const auto& match : matches) {
+            values.push_back(match.second);
+        }
+        display_column(metadata, column_name, values);
+    }
+    return success;
+}
+
+/**
+ * @brief Verifies if all columns are in the same group
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] columns Vector of column names to check
+ * @return Group index if all columns are in same group, -1 otherwise
+ */
+int verify_same_group(const json& metadata, const std::vector<std::string>& columns) {
+    if (columns.empty()) return -1;
+
+    auto [first_group, first_col] = get_column_info(metadata, columns[0]);
+    if (first_group == -1) return -1;
+
+    for (size_t i = 1; i < columns.size(); ++i) {
+        if (columns[i].empty()) {
+            std::cerr << "Error: Empty column name at index " << i << std::endl;
+            return -1;
+        }
+        auto [group_idx, col_idx] = get_column_info(metadata, columns[i]);
+        if (group_idx == -1 || group_idx != first_group) {
+            return -1;
+        }
+    }
+
+    return first_group;
+}
+
+/**
+ * @brief Projects multiple columns from the HTY file
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] projected_columns Names of the columns to project
+ * @return Vector of vectors containing the projected column values
+ */
+std::vector<std::vector<float>> project(const json& metadata, const Snapshot& snapshot,
+                                      const std::string& hty_file_path,
+                                      const std::vector<std::string>& projected_columns) {
+    std::vector<std::vector<float>> result;
+    
+    // Verify all columns are in the same group
+    int group_index = verify_same_group(metadata, projected_columns);
+    if (group_index == -1) {
+        return result;
+    }
+    
+    // Open file
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return result;
+    }
+    
+    // Get column indices
+    std::vector<int> column_indices;
+    for (const auto& col_name : projected_columns) {
+        auto [_, col_idx] = get_column_info(metadata, col_name);
+        column_indices.push_back(col_idx);
+    }
+    
+    // Read every stored row of each column, then drop deleted rows
+    auto live = load_live_rows(metadata, file);
+    for (int col_idx : column_indices) {
+        result.push_back(select_values(read_column(metadata, file, group_index, col_idx),
+                                       live));
+    }
+    
+    file.close();
+    return result;
+}
+
+/**
+ * @brief Projects columns and applies filter condition
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] projected_columns Names of columns to project
+ * @param[in] filtered_column Name of column to filter on
+ * @param[in] op Filter operation to apply
+ * @param[in] value Filter value to compare against
+ * @param[out] result Vector of vectors containing filtered column values
+ * @return true on success, false otherwise
+ */
+bool project_and_filter(const json& metadata, const Snapshot& snapshot,
+                        const std::string& hty_file_path,
+                        const std::vector<std::string>& projected_columns,
+                        const std::string& filtered_column,
+                        int op,
+                        float value,
+                        std::vector<std::vector<float>>& result) {
+    
+    // Create a combined vector of all columns we need
+    std::vector<std::string> all_columns = projected_columns;
+    if (std::find(all_columns.begin(), all_columns.end(), filtered_column) == all_columns.end()) {
+        all_columns.push_back(filtered_column);
+    }
+    
+    // Verify all columns are in the same group
+    int group_index = verify_same_group(metadata, all_columns);
+    if (group_index == -1) {
+        return false;
+    }
+    
+    // Open file
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
+    }
+    
+    // Get column indices
+    std::vector<int> proj_indices;
+    for (const auto& col_name : projected_columns) {
+        auto [_, col_idx] = get_column_info(metadata, col_name);
+        proj_indices.push_back(col_idx);
+    }
+    
+    auto [_, filter_col_idx] = get_column_info(metadata, filtered_column);
+    
+    // Evaluate the filter, mask out deleted rows, then fetch matching rows
+    auto selection = evaluate_filter(metadata, file, hty_file_path, group_index, filter_col_idx,
+                                     op, value);
+    auto live = load_live_rows(metadata, file);
+    if (!live.empty()) {
+        and_bitmaps(selection.data(), live.data(), selection.size());
+    }
+    if (!gather_rows(metadata, snapshot, file, hty_file_path, group_index, proj_indices, selection,
+                     result)) {
+        return false;
+    }
+    
+    file.close();
+    return true;
+}
+
+/**
+ * @brief Computes SUM, COUNT, MIN and MAX of a column over live rows
+ *
+ * The optional filter may be on a column of any group, since a selection
+ * bitmap is indexed by row. Columnar chunks are aggregated by the chunk
+ * kernels, so run-length chunks never expand their runs. Segments with
+ * no selected row are not read, and unless the sum is needed, neither
+ * are segments selected whole that have a zone map.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column Name of the aggregated column
+ * @param[in] filtered_column Name of the column to filter on, empty for none
+ * @param[in] op Filter operation to apply
+ * @param[in] value Filter value to compare against
+ * @param[in] need_sum false if only COUNT, MIN and MAX of the result are used
+ * @param[out] result Aggregate of the selected rows
+ * @return true on success, false otherwise
+ */
+bool aggregate_column(const json& metadata, const Snapshot& snapshot,
+                      const std::string& hty_file_path,
+                      const std::string& column,
+                      const std::string& filtered_column,
+                      int op,
+                      float value,
+                      bool need_sum,
+                      Aggregate& result) {
+    std::ifstream file = open_snapshot(snapshot, hty_file_path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
+    }
+
+    auto [group_index, column_index] = get_column_info(metadata, column);
+    if (group_index == -1) {
+        return false;
+    }
+
+    bool is_int = is_int_column(metadata["groups"][group_index]["columns"][column_index]);
+    long long segment_start = 0;
+    try {
+        // Selected rows: matching and live, or just live; empty selects every row
+        std::vector<uint64_t> selection = load_live_rows(metadata, file);
+        if (!filtered_column.empty()) {
+            auto [filter_group, filter_index] = get_column_info(metadata, filtered_column);
+            if (filter_group == -1) {
+                return false;
+            }
+            auto matches = evaluate_filter(metadata, file, hty_file_path, filter_group,
+                                           filter_index, op, value);
+            if (!selection.empty()) {
+                and_bitmaps(matches.data(), selection.data(), matches.size());
+            }
+            selection = std::move(matches);
+        }
+
+        for (const auto& segment : get_group_segments(metadata, group_index)) {
+            long long segment_end = segment_start + segment.num_rows;
+            long long selected = selection.empty() ? segment.num_rows
+                                                   : count_bits(selection, segment_start,
+                                                                segment_end);
+            ZoneMap zone = segment_zone(segment, column_index);
+            if (selected == 0 || (!need_sum && selected == segment.num_rows && zone.known)) {
+                if (selected > 0) {
+                    result.add_zone(zone, segment.num_rows);
+                }
+                segment_start = segment_end;
+                continue;
+            }
+            if (!segment.chunks.is_null()) {
+                const auto& chunk = segment.chunks[column_index];
+                aggregate_chunk(chunk, read_chunk(file, chunk), segment.num_rows, is_int,
+                                selection, segment_start, result,
+                                read_validity(file, chunk, segment.num_rows));
+            } else {
+                auto values = read_segment_column(metadata, file, group_index, segment,
+                                                  column_index);
+                for (int i = 0; i < segment.num_rows; ++i) {
+                    if (selection.empty() || test_bit(selection, segment_start + i)) {
+                        result.add(values[i], 1);
+                    }
+                }
+            }
+            segment_start += segment.num_rows;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return false;
+    }
+
+    file.close();
+    return true;
+}
+
+/**
+ * @brief Displays multiple columns of data
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] column_names Names of the columns to display
+ * @param[in] result_set Vector of vectors containing the column values
+ */
+void display_result_set(const json& metadata,
+                       const std::vector<std::string>& column_names,
+                       const std::vector<std::vector<float>>& result_set) {
+    if (result_set.empty() || column_names.empty()) return;
+    
+    // Print header
+    for (size_t i = 0; i < column_names.size(); ++i) {
+        std::cout << column_names[i];
+        if (i < column_names.size() - 1) std::cout << ",";
+    }
+    std::cout << std::endl;
+    
+    // Print data rows
+    for (size_t row = 0; row < result_set[0].size(); ++row) {
+        for (size_t col = 0; col < result_set.size(); ++col) {
+            std::cout << format_large_number(result_set[col][row]);
+            if (col < result_set.size() - 1) std::cout << ",";
+        }
+        std::cout << std::endl;
+    }
+}
+
+/**
+ * @brief Checks that a column can store a value as given
+ * @param[in] column Column entry of the metadata
+ * @param[in] value Value as seen through the API
+ * @param[in] row Input row number for the error message, -1 for none
+ * @return true if the value fits, false otherwise
+ */
+bool check_column_value(const json& column, float value, long long row) {
+    if (is_int_column(column) && !fits_int_column(value)) {
+        std::cerr << "Error: ";
+        if (row >= 0) {
+            std::cerr << "Row " << row << ": ";
+        }
+        std::cerr << "int column " << column["column_name"].get<std::string>()
+                  << " cannot store " << value << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Validates row data against metadata requirements
+ *
+ * Rows must cover every column, and values of "int" columns must be
+ * integers the column can store.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] rows Vector of row data to validate
+ * @return true if valid, false otherwise
+ */
+bool validate_rows(const json& metadata, const std::vector<std::vector<float>>& rows) {
+    if (rows.empty()) {
+        std::cerr << "Error: No rows provided" << std::endl;
+        return false;
+    }
+
+    int total_columns = 0;
+    for (const auto& group : metadata["groups"]) {
+        total_columns += group["num_columns"].get<int>();
+    }
+    
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (rows[i].size() != static_cast<size_t>(total_columns)) {
+            std::cerr << "Error: Row " << i << " has incorrect number of columns. "
+                     << "Expected: " << total_columns 
+                     << ", Got: " << rows[i].size() << std::endl;
+            return false;
+        }
+        size_t col = 0;
+        for (const auto& group : metadata["groups"]) {
+            for (const auto& column : group["columns"]) {
+                if (!check_column_value(column, rows[i][col++], i)) {
+                    return false;
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Creates an empty batch shaped after the file's column groups
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] capacity Number of rows to reserve room for
+ * @return Batch with one empty slice per group
+ */
+RowBatch make_batch(const json& metadata, size_t capacity) {
+    RowBatch batch;
+    for (const auto& group : metadata["groups"]) {
+        batch.groups.emplace_back();
+        batch.groups.back().reserve(capacity * group["num_columns"].get<int>());
+    }
+    return batch;
+}
+
+/**
+ * @brief Converts the values of "int" columns in a batch to their stored form
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in,out] batch Batch holding values as seen through the API
+ */
+void store_batch(const json& metadata, RowBatch& batch) {
+    for (size_t group_idx = 0; group_idx < batch.groups.size(); ++group_idx) {
+        const auto& columns = metadata["groups"][group_idx]["columns"];
+        auto& slice = batch.groups[group_idx];
+        for (size_t col = 0; col < columns.size(); ++col) {
+            if (!is_int_column(columns[col])) {
+                continue;
+            }
+            for (size_t i = col; i < slice.size(); i += columns.size()) {
+                slice[i] = store_value(slice[i], true);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Splits full rows into a batch of per-group slices
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] rows Rows holding values for every column
+ * @return Batch holding the same rows
+ */
+RowBatch make_batch(const json& metadata, const std::vector<std::vector<float>>& rows) {
+    RowBatch batch = make_batch(metadata, rows.size());
+    for (const auto& row : rows) {
+        auto value = row.begin();
+        for (size_t group_idx = 0; group_idx < batch.groups.size(); ++group_idx) {
+            int group_columns = metadata["groups"][group_idx]["num_columns"];
+            batch.groups[group_idx].insert(batch.groups[group_idx].end(),
+                                           value, value + group_columns);
+            value += group_columns;
+        }
+    }
+    batch.num_rows = rows.size();
+    store_batch(metadata, batch);
+    return batch;
+}
+
+/**
+ * @brief Writes a whole buffer at a file offset, retrying short writes
+ * @param[in] fd File descriptor to write to
+ * @param[in] data Bytes to write
+ * @param[in] size Number of bytes to write
+ * @param[in] offset File offset of the first byte
+ * @return true on success, false otherwise
+ */
+bool write_all(int fd, const char* data, size_t size, long long offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * @brief Copies a byte range between files without staging it in user space
+ *
+ * Tries, cheapest first, a reflink clone (block-aligned ranges only),
+ * copy_file_range, sendfile, and finally a bounded pread/pwrite loop, so
+ * each filesystem gets the best mechanism it supports.
+ *
+ * @param[in] in_fd Descriptor of the source file
+ * @param[in] in_offset Offset of the range in the source
+ * @param[in] out_fd Descriptor of the destination file
+ * @param[in] out_offset Offset of the range in the destination
+ * @param[in] size Number of bytes to copy
+ * @return true on success, false on a short read or write error
+ */
+bool copy_range(int in_fd, long long in_offset, int out_fd, long long out_offset,
+                long long size) {
+#ifdef FICLONERANGE
+    struct stat out_stat;
+    if (size > 0 && fstat(out_fd, &out_stat) == 0 && out_stat.st_blksize > 0 &&
+        in_offset % out_stat.st_blksize == 0 && out_offset % out_stat.st_blksize == 0 &&
+        size % out_stat.st_blksize == 0) {
+        struct file_clone_range range = {};
+        range.src_fd = in_fd;
+        range.src_offset = in_offset;
+        range.src_length = size;
+        range.dest_offset = out_offset;
+        if (ioctl(out_fd, FICLONERANGE, &range) == 0) {
+            return true;
+        }
+    }
+#endif
+
+    loff_t src = in_offset;
+    loff_t dst = out_offset;
+    long long remaining = size;
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range(in_fd, &src, out_fd, &dst, remaining, 0);
+        if (copied <= 0) {
+            break;
+        }
+        remaining -= copied;
+    }
+
+    // sendfile writes at the destination's file position
+    if (remaining > 0 && lseek(out_fd, dst, SEEK_SET) == dst) {
+        off_t sent_src = src;
+        while (remaining > 0) {
+            ssize_t copied = sendfile(out_fd, in_fd, &sent_src, remaining);
+            if (copied <= 0) {
+                break;
+            }
+            remaining -= copied;
+            dst += copied;
+        }
+        src = sent_src;
+    }
+
+    if (remaining > 0) {
+        std::vector<char> buffer(std::min<long long>(remaining, COPY_BUFFER_SIZE));
+        while (remaining > 0) {
+            long long chunk = std::min<long long>(remaining, buffer.size());
+            ssize_t bytes_read = pread(in_fd, buffer.data(), chunk, src);
+            if (bytes_read <= 0 || !write_all(out_fd, buffer.data(), bytes_read, dst)) {
+                return false;
+            }
+            src += bytes_read;
+            dst += bytes_read;
+            remaining -= bytes_read;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Renames a synced file into place and syncs the directory entry
+ * @param[in] from Current path of the file
+ * @param[in] to Path to give it, replaced atomically if it exists
+ * @return true on success, false otherwise
+ */
+bool rename_durably(const std::string& from, const std::string& to) {
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        std::cerr << "Error: Unable to rename " << from << " to " << to << ": "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::string dir = std::filesystem::absolute(to).parent_path().string();
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the last stored row of a group's sorted columns
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @param[in] group_index Index of the group
+ * @return One value per column, -infinity for unsorted columns or an empty group
+ */
+std::vector<float> last_sorted_values(const json& metadata, std::istream& file,
+                                      int group_index) {
+    const auto& columns = metadata["groups"][group_index]["columns"];
+    std::vector<float> last(columns.size(), -INFINITY);
+    auto segments = get_group_segments(metadata, group_index);
+    while (!segments.empty() && segments.back().num_rows == 0) {
+        segments.pop_back();
+    }
+    for (size_t col = 0; col < columns.size() && !segments.empty(); ++col) {
+        if (columns[col].value("sorted", false)) {
+            last[col] = read_segment_column(metadata, file, group_index, segments.back(),
+                                            col).back();
+        }
+    }
+    return last;
+}
+
+/**
+ * @brief Clears the sorted mark of columns that new rows put out of order
+ *
+ * A sorted column stays sorted only if the new rows, taken in order,
+ * never decrease from the last value before them and hold no nulls.
+ *
+ * @param[in,out] group Group entry of the new metadata
+ * @param[in] rows New rows of the group, laid out as on disk
+ * @param[in] num_rows Number of new rows
+ * @param[in,out] last Last value of each column so far, updated to the new rows
+ */
+void check_sort_order(json& group, const float* rows, long long num_rows,
+                      std::vector<float>& last) {
+    int num_columns = group["num_columns"];
+    for (int col = 0; col < num_columns; ++col) {
+        auto& column = group["columns"][col];
+        if (!column.value("sorted", false)) {
+            continue;
+        }
+        bool is_int = is_int_column(column);
+        for (long long row = 0; row < num_rows; ++row) {
+            float value = load_value(rows[row * num_columns + col], is_int);
+            if (std::isnan(value) || value < last[col]) {
+                column.erase("sorted");
+                break;
+            }
+            last[col] = value;
+        }
+    }
+}
+
+/**
+ * @brief Walks the rows added to a group, spooled ones first, a block at a time
+ * @param[in] spool_fds Per-group files of rows laid out as on disk, possibly none
+ * @param[in] spool_rows Number of spooled rows
+ * @param[in] batch Rows added after the spooled ones, possibly none
+ * @param[in] group_idx Index of the group
+ * @param[in] num_columns Number of columns in the group
+ * @param[in] visit Called with each block of rows and its row count
+ * @return false if the spooled rows cannot be read
+ */
+bool scan_added_rows(const std::vector<int>& spool_fds, long long spool_rows,
+                     const RowBatch& batch, size_t group_idx, int num_columns,
+                     const std::function<void(const float*, long long)>& visit) {
+    std::vector<float> rows;
+    for (long long row = 0; !spool_fds.empty() && row < spool_rows; row += HTY_BLOCK_ROWS) {
+        long long count = std::min<long long>(HTY_BLOCK_ROWS, spool_rows - row);
+        rows.resize(count * num_columns);
+        ssize_t size = rows.size() * sizeof(float);
+        if (pread(spool_fds[group_idx], rows.data(), size,
+                  row * num_columns * sizeof(float)) != size) {
+            std::cerr << "Error: Unable to read spooled rows" << std::endl;
+            return false;
+        }
+        visit(rows.data(), count);
+    }
+    if (batch.num_rows > 0) {
+        visit(batch.groups[group_idx].data(), batch.num_rows);
+    }
+    return true;
+}
+
+/**
+ * @brief Keeps sorted marks only where new rows continue the order
+ * @param[in] metadata Metadata the rows are added to
+ * @param[in] file Open HTY file
+ * @param[in,out] new_metadata Metadata describing the file with the new rows
+ * @param[in] spool_fds Per-group files of spooled rows, empty if none
+ * @param[in] spool_rows Number of spooled rows
+ * @param[in] batch Rows added after the spooled ones
+ * @return false if the spooled rows cannot be read
+ */
+bool update_sort_order(const json& metadata, std::istream& file, json& new_metadata,
+                       const std::vector<int>& spool_fds, long long spool_rows,
+                       const RowBatch& batch) {
+    for (size_t group_idx = 0; group_idx < new_metadata["groups"].size(); ++group_idx) {
+        auto& group = new_metadata["groups"][group_idx];
+        bool any_sorted = false;
+        for (const auto& column : group["columns"]) {
+            any_sorted = any_sorted || column.value("sorted", false);
+        }
+        if (!any_sorted || (spool_rows == 0 && batch.num_rows == 0)) {
+            continue;
+        }
+
+        std::vector<float> last = last_sorted_values(metadata, file, group_idx);
+        if (!scan_added_rows(spool_fds, spool_rows, batch, group_idx, group["num_columns"],
+                             [&](const float* rows, long long count) {
+                                 check_sort_order(group, rows, count, last);
+                             })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Recomputes the statistics of every column from its live rows
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] file Open HTY file
+ * @param[in] deleted Deletion bitmap, empty if no row was deleted
+ * @param[in,out] new_metadata Metadata whose column entries receive "stats"
+ */
+void compute_statistics(const json& metadata, std::istream& file,
+                        const std::vector<uint64_t>& deleted, json& new_metadata) {
+    for (size_t group_idx = 0; group_idx < new_metadata["groups"].size(); ++group_idx) {
+        auto& columns = new_metadata["groups"][group_idx]["columns"];
+        for (size_t col = 0; col < columns.size(); ++col) {
+            auto values = read_column(metadata, file, group_idx, col);
+            size_t kept = 0;
+            for (size_t row = 0; row < values.size(); ++row) {
+                if (!test_bit(deleted, row)) {
+                    values[kept++] = values[row];
+                }
+            }
+            values.resize(kept);
+            columns[col]["stats"] = column_statistics(std::move(values));
+        }
+    }
+}
+
+/**
+ * @brief Folds appended rows into the counts and sketches of column statistics
+ *
+ * Histograms are left as they are until the next compaction; estimates
+ * use them as shares of the rows, which drift slowly as rows are added.
+ *
+ * @param[in,out] new_metadata Metadata whose statistics are updated
+ * @param[in] spool_fds Per-group files of rows laid out as on disk, possibly none
+ * @param[in] spool_rows Number of spooled rows
+ * @param[in] batch Rows to add, possibly none
+ * @return true on success, false if the spool could not be read
+ */
+bool fold_statistics(json& new_metadata, const std::vector<int>& spool_fds,
+                     long long spool_rows, const RowBatch& batch) {
+    for (size_t group_idx = 0; group_idx < new_metadata["groups"].size(); ++group_idx) {
+        auto& columns = new_metadata["groups"][group_idx]["columns"];
+        int num_columns = columns.size();
+        std::vector<std::vector<uint8_t>> registers(num_columns);
+        std::vector<long long> num_values(num_columns, 0), null_count(num_columns, 0);
+        bool any_stats = false;
+        for (int col = 0; col < num_columns; ++col) {
+            if (columns[col].contains("stats")) {
+                registers[col] = hll_from_hex(columns[col]["stats"]["hll"]);
+                any_stats = true;
+            }
+        }
+        if (!any_stats || (spool_rows == 0 && batch.num_rows == 0)) {
+            continue;
+        }
+
+        auto add_rows = [&](const float* rows, long long count) {
+            for (int col = 0; col < num_columns; ++col) {
+                if (registers[col].empty()) {
+                    continue;
+                }
+                bool is_int = is_int_column(columns[col]);
+                for (long long row = 0; row < count; ++row) {
+                    float value = load_value(rows[row * num_columns + col], is_int);
+                    if (std::isnan(value)) {
+                        ++null_count[col];
+                    } else {
+                        ++num_values[col];
+                        hll_add(registers[col], value);
+                    }
+                }
+            }
+        };
+        if (!scan_added_rows(spool_fds, spool_rows, batch, group_idx, num_columns, add_rows)) {
+            return false;
+        }
+
+        for (int col = 0; col < num_columns; ++col) {
+            if (registers[col].empty()) {
+                continue;
+            }
+            auto& stats = columns[col]["stats"];
+            stats["num_values"] = stats["num_values"].get<long long>() + num_values[col];
+            stats["null_count"] = stats["null_count"].get<long long>() + null_count[col];
+            stats["hll"] = hll_to_hex(registers[col]);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Rewrites one columnar group as fresh blocks
+ *
+ * Blocks without deleted rows are copied chunk by chunk without decoding
+ * as long as no rows are waiting ahead of them. Everything else, delta
+ * segments, spooled rows and new rows included, is decoded, stripped of
+ * deleted rows and re-encoded in blocks of the group's block size.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the source HTY file
+ * @param[in] group_index Index of the group
+ * @param[in] input_fd Open source file
+ * @param[in] deleted Deletion bitmap, empty if no row was deleted
+ * @param[in] output_fd Open destination file
+ * @param[in,out] offset Destination offset, set to -1 on failure
+ * @param[in] spool_fd File of spooled rows laid out as on disk, -1 if none
+ * @param[in] spool_rows Number of spooled rows
+ * @param[in] batch Rows to add after the existing ones, possibly none
+ * @return Segment entries of the rewritten group
+ */
+json rewrite_columnar_group(const json& metadata, const Snapshot& snapshot,
+                            const std::string& hty_file_path,
+                            int group_index, int input_fd,
+                            const std::vector<uint64_t>& deleted, int output_fd,
+                            long long& offset, int spool_fd, long long spool_rows,
+                            const RowBatch& batch) {
+    const auto& group = metadata["groups"][group_index];
+    int group_columns = group["num_columns"];
+    size_t block_rows = group["block_rows"].get<size_t>();
+    json segments = json::array();
+
+    std::vector<std::vector<float>> pending(group_columns);
+    std::string bytes;
+    auto flush = [&](bool all) {
+        size_t start = 0;
+        while (offset >= 0 && (pending[0].size() - start >= block_rows ||
+                               (all && pending[0].size() > start))) {
+            size_t count = std::min(block_rows, pending[0].size() - start);
+            std::vector<std::vector<float>> block(group_columns);
+            for (int col = 0; col < group_columns; ++col) {
+                block[col].assign(pending[col].begin() + start,
+                                  pending[col].begin() + start + count);
+            }
+            segments.push_back(encode_block(group["columns"], block, offset, bytes,
+                                            group.value("compression", "")));
+            if (!write_all(output_fd, bytes.data(), bytes.size(), offset)) {
+                std::cerr << "Error: Unable to write block" << std::endl;
+                offset = -1;
+                break;
+            }
+            offset += bytes.size();
+            start += count;
+        }
+        for (auto& column : pending) {
+            column.erase(column.begin(), column.begin() + std::min(start, column.size()));
+        }
+    };
+
+    // Append row-major rows, laid out as on disk, to the pending columns
+    std::vector<bool> int_columns;
+    for (const auto& column : group["columns"]) {
+        int_columns.push_back(is_int_column(column));
+    }
+    auto add_row_major = [&](const float* rows, size_t num_rows) {
+        for (size_t row = 0; row < num_rows; ++row) {
+            for (int col = 0; col < group_columns; ++col) {
+                pending[col].push_back(load_value(rows[row * group_columns + col],
+                                                  int_columns[col]));
+            }
+        }
+        flush(false);
+    };
+
+    std::ifstream input = open_snapshot(snapshot, hty_file_path);
+
+    long long segment_start = 0;
+    for (const auto& segment : get_group_segments(metadata, group_index)) {
+        if (offset < 0) {
+            break;
+        }
+        bool any_deleted = false;
+        for (int row = 0; row < segment.num_rows && !any_deleted; ++row) {
+            any_deleted = test_bit(deleted, segment_start + row);
+        }
+
+        if (!segment.chunks.is_null() && !any_deleted && pending[0].empty()) {
+            json copied = {{"offset", offset}, {"num_rows", segment.num_rows},
+                           {"chunks", segment.chunks}};
+            for (auto& chunk : copied["chunks"]) {
+                // Validity bitmaps and Bloom filters follow the payload and move with it
+                long long size = chunk_extent(chunk, segment.num_rows);
+                if (!copy_range(input_fd, chunk["offset"].get<long long>(), output_fd, offset,
+                                size)) {
+                    std::cerr << "Error: Unable to copy block" << std::endl;
+                    offset = -1;
+                    break;
+                }
+                relocate_chunk(chunk, offset);
+                offset += size;
+            }
+            segments.push_back(copied);
+        } else {
+            std::vector<std::vector<float>> columns;
+            for (int col = 0; col < group_columns; ++col) {
+                columns.push_back(read_segment_column(metadata, input, group_index,
+                                                      segment, col));
+            }
+            for (int row = 0; row < segment.num_rows; ++row) {
+                if (test_bit(deleted, segment_start + row)) {
+                    continue;
+                }
+                for (int col = 0; col < group_columns; ++col) {
+                    pending[col].push_back(columns[col][row]);
+                }
+            }
+            flush(false);
+        }
+        segment_start += segment.num_rows;
+    }
+
+    // Spooled rows, a block at a time
+    std::vector<float> rows(block_rows * group_columns);
+    for (long long row = 0; spool_fd >= 0 && row < spool_rows && offset >= 0;
+         row += block_rows) {
+        size_t count = std::min<long long>(block_rows, spool_rows - row);
+        size_t size = count * group_columns * sizeof(float);
+        if (pread(spool_fd, rows.data(), size, row * group_columns * sizeof(float)) !=
+            static_cast<ssize_t>(size)) {
+            std::cerr << "Error: Unable to read spooled rows" << std::endl;
+            offset = -1;
+            break;
+        }
+        add_row_major(rows.data(), count);
+    }
+
+    if (batch.num_rows > 0 && offset >= 0) {
+        add_row_major(batch.groups[group_index].data(), batch.num_rows);
+    }
+    flush(true);
+    return segments;
+}
+
+/**
+ * @brief Computes the zone maps of row-major groups being rewritten
+ *
+ * Zones of segments that lose no rows are merged as they are. If a
+ * segment loses rows or has none, the group's zones come from freshly
+ * computed statistics when there are any and are dropped otherwise.
+ * Added rows are folded in either way.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] deleted Deletion bitmap, empty if no row was deleted
+ * @param[in] fresh_statistics true if the column statistics cover exactly the live rows
+ * @param[in] spool_fds Per-group files of rows laid out as on disk, possibly none
+ * @param[in] spool_rows Number of spooled rows
+ * @param[in] batch Rows to add, possibly none
+ * @param[in,out] new_metadata Metadata whose row-major groups receive "zones"
+ * @return false if the spooled rows cannot be read
+ */
+bool rewrite_zones(const json& metadata, const std::vector<uint64_t>& deleted,
+                   bool fresh_statistics, const std::vector<int>& spool_fds,
+                   long long spool_rows, const RowBatch& batch, json& new_metadata) {
+    for (size_t group_idx = 0; group_idx < new_metadata["groups"].size(); ++group_idx) {
+        auto& new_group = new_metadata["groups"][group_idx];
+        if (is_columnar_group(new_group)) {
+            continue;
+        }
+        const auto& columns = new_group["columns"];
+        int num_columns = columns.size();
+        std::vector<ZoneMap> zones(num_columns);
+        long long segment_start = 0;
+        long long deleted_bits = static_cast<long long>(deleted.size()) * 64;
+        bool known = true;
+        for (const auto& segment : get_group_segments(metadata, group_idx)) {
+            long long segment_end = segment_start + segment.num_rows;
+            known = known && count_bits(deleted, std::min(segment_start, deleted_bits),
+                                        std::min(segment_end, deleted_bits)) == 0;
+            for (int col = 0; col < num_columns; ++col) {
+                zones[col].merge(segment_zone(segment, col));
+                known = known && zones[col].known;
+            }
+            segment_start = segment_end;
+        }
+
+        for (int col = 0; !known && fresh_statistics && col < num_columns; ++col) {
+            const auto& stats = columns[col]["stats"];
+            zones[col] = ZoneMap();
+            zones[col].null_count = stats["null_count"].get<long long>();
+            if (!stats["histogram"].empty()) {
+                zones[col].min = stats["histogram"].front().get<float>();
+                zones[col].max = stats["histogram"].back().get<float>();
+            }
+        }
+        if (!known && !fresh_statistics) {
+            new_group.erase("zones");
+            continue;
+        }
+
+        if (!scan_added_rows(spool_fds, spool_rows, batch, group_idx, num_columns,
+                             [&](const float* rows, long long count) {
+                                 for (int col = 0; col < num_columns; ++col) {
+                                     bool is_int = is_int_column(columns[col]);
+                                     for (long long row = 0; row < count; ++row) {
+                                         zones[col].add(load_value(rows[row * num_columns + col],
+                                                                   is_int));
+                                     }
+                                 }
+                             })) {
+            return false;
+        }
+        new_group["zones"] = json::array();
+        for (const auto& zone : zones) {
+            new_group["zones"].push_back(zone.entry());
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Rewrites an HTY file with every group stored contiguously
+ *
+ * All segments of a group are copied back to back, followed by the group's
+ * spooled rows and then its slice of the batch, so the output has no delta
+ * segments left. Existing and spooled bytes never pass through user space
+ * when the kernel can copy them directly. The output is built in a
+ * temporary file that is synced and then renamed over output_path, so a
+ * crash leaves either the old destination or the complete new one.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the source HTY file
+ * @param[in] output_path Path to the destination HTY file
+ * @param[in] batch Rows to add after the existing ones, possibly none
+ * @param[in] spool_fds Optional per-group files of rows laid out as on disk
+ * @param[in] refresh_statistics Whether to recompute column statistics from scratch
+ * @return true on success, false otherwise
+ */
+bool rewrite_file(const json& metadata, const Snapshot& snapshot,
+                  const std::string& hty_file_path,
+                  const std::string& output_path,
+                  const RowBatch& batch,
+                  const std::vector<int>& spool_fds = {},
+                  bool refresh_statistics = false) {
+    // Open input file for reading
+    int input_fd = open(snapshot_path(snapshot, hty_file_path).c_str(), O_RDONLY);
+    if (input_fd < 0) {
+        std::cerr << "Error: Unable to open input file: " << hty_file_path << std::endl;
+        return false;
+    }
+
+    // Open output file for writing
+    std::string tmp_path = output_path + REWRITE_TMP_SUFFIX;
+    int output_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_fd < 0) {
+        std::cerr << "Error: Unable to open output file: " << tmp_path << std::endl;
+        close(input_fd);
+        return false;
+    }
+
+    bool success = true;
+    try {
+        // Count spooled rows from the size of the first group's spool
+        long long spool_rows = 0;
+        if (!spool_fds.empty()) {
+            struct stat spool_stat;
+            if (fstat(spool_fds[0], &spool_stat) != 0) {
+                throw std::runtime_error("Unable to read spool size");
+            }
+            spool_rows = spool_stat.st_size /
+                         (metadata["groups"][0]["num_columns"].get<int>() * sizeof(float));
+        }
+
+        // Deleted rows are dropped, so the output needs no deletion vector
+        std::vector<uint64_t> deleted;
+        long long live_rows = metadata["num_rows"].get<long long>();
+        if (metadata.contains("deletion_vector")) {
+            std::ifstream input_stream = open_snapshot(snapshot, hty_file_path);
+            deleted = load_deleted_rows(metadata, input_stream);
+            live_rows -= metadata["deletion_vector"]["num_deleted"].get<long long>();
+        }
+
+        // Create new metadata with updated row count
+        json new_metadata = metadata;
+        new_metadata["num_rows"] = live_rows + spool_rows + batch.num_rows;
+        new_metadata.erase("deletion_vector");
+
+        // Rows are renumbered, which invalidates indexes built on the old generation
+        new_metadata["generation"] = metadata.value("generation", 0ULL) + 1;
+        {
+            std::ifstream input_stream = open_snapshot(snapshot, hty_file_path);
+            success = update_sort_order(metadata, input_stream, new_metadata, spool_fds,
+                                        spool_rows, batch);
+            if (success && refresh_statistics) {
+                compute_statistics(metadata, input_stream, deleted, new_metadata);
+            }
+        }
+        success = success && rewrite_zones(metadata, deleted, refresh_statistics, spool_fds,
+                                           spool_rows, batch, new_metadata) &&
+                  fold_statistics(new_metadata, spool_fds, spool_rows, batch);
+
+        // Log positions only mean something to the file's own log, and a new
+        // file must not pick up indexes built on whatever was at its path
+        if (output_path != hty_file_path) {
+            new_metadata.erase("wal_lsn");
+            new_metadata["file_id"] = new_file_id();
+        }
+
+        // Copy existing data and add new rows, group by group
+        long long current_offset = 0;
+        int total_groups = metadata["num_groups"];
+
+        for (int group_idx = 0; group_idx < total_groups && success; ++group_idx) {
+            const auto& group = metadata["groups"][group_idx];
+            int group_columns = group["num_columns"];
+
+            if (is_columnar_group(group)) {
+                auto& new_group = new_metadata["groups"][group_idx];
+                int spool_fd = spool_fds.empty() ? -1 : spool_fds[group_idx];
+                new_group["offset"] = current_offset;
+                new_group["segments"] = rewrite_columnar_group(
+                    metadata, snapshot, hty_file_path, group_idx, input_fd, deleted, output_fd,
+                    current_offset, spool_fd, spool_rows, batch);
+                success = current_offset >= 0;
+                continue;
+            }
+            
+            // Update offset in new metadata; the rewritten group is contiguous
+            new_metadata["groups"][group_idx]["offset"] = current_offset;
+            new_metadata["groups"][group_idx].erase("segments");
+
+            // Copy existing group data, segment by segment, in runs of live rows
+            long long row_size = group_columns * sizeof(float);
+            long long segment_start = 0;
+            for (const auto& segment : get_group_segments(metadata, group_idx)) {
+                long long row = 0;
+                while (row < segment.num_rows && success) {
+                    while (row < segment.num_rows && test_bit(deleted, segment_start + row)) {
+                        ++row;
+                    }
+                    long long run_start = row;
+                    while (row < segment.num_rows && !test_bit(deleted, segment_start + row)) {
+                        ++row;
+                    }
+                    long long run_size = (row - run_start) * row_size;
+                    if (!copy_range(input_fd, segment.offset + run_start * row_size,
+                                    output_fd, current_offset, run_size)) {
+                        std::cerr << "Error: Unable to copy segment of " << hty_file_path
+                                  << std::endl;
+                        success = false;
+                    }
+                    current_offset += run_size;
+                }
+                segment_start += segment.num_rows;
+            }
+
+            // Copy spooled rows for this group
+            if (success && !spool_fds.empty()) {
+                long long spool_size = spool_rows * group_columns * sizeof(float);
+                if (!copy_range(spool_fds[group_idx], 0, output_fd, current_offset,
+                                spool_size)) {
+                    std::cerr << "Error: Unable to copy spooled rows" << std::endl;
+                    success = false;
+                }
+                current_offset += spool_size;
+            }
+
+            // Write new rows for this group in a single call
+            if (success && batch.num_rows > 0) {
+                const auto& slice = batch.groups[group_idx];
+                size_t slice_size = slice.size() * sizeof(float);
+                if (!write_all(output_fd, reinterpret_cast<const char*>(slice.data()),
+                               slice_size, current_offset)) {
+                    std::cerr << "Error: Unable to write rows to " << output_path << std::endl;
+                    success = false;
+                }
+                current_offset += slice_size;
+            }
+        }
+
+        // Write new metadata and its size
+        std::string footer = serialize_footer(new_metadata);
+        if (success && !write_all(output_fd, footer.data(), footer.size(), current_offset)) {
+            std::cerr << "Error: Unable to write metadata to " << output_path << std::endl;
+            success = false;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        success = false;
+    }
+
+    close(input_fd);
+    if (success && fdatasync(output_fd) != 0) {
+        std::cerr << "Error: Unable to sync " << tmp_path << std::endl;
+        success = false;
+    }
+    if (close(output_fd) != 0) {
+        success = false;
+    }
+
+    // Publish the complete file atomically
+    if (success && !rename_durably(tmp_path, output_path)) {
+        success = false;
+    }
+    if (!success) {
+        unlink(tmp_path.c_str());
+    }
+    return success;
+}
+
+/**
+ * @brief Adds new rows to HTY file
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the source HTY file
+ * @param[in] modified_hty_file_path Path to the destination HTY file
+ * @param[in] rows Vector of vectors containing new row data
+ */
+void add_row(const json& metadata, const Snapshot& snapshot, 
+             const std::string& hty_file_path,
+             const std::string& modified_hty_file_path,
+             const std::vector<std::vector<float>>& rows) {
+    // Validate input rows
+    if (!validate_rows(metadata, rows)) {
+        return;
+    }
+
+    rewrite_file(metadata, snapshot, hty_file_path, modified_hty_file_path,
+                 make_batch(metadata, rows));
+}
+
+/**
+ * @brief Takes the exclusive writer lock of an HTY file
+ *
+ * The lock lives in a sidecar file rather than on the HTY file itself
+ * because compaction replaces the HTY file with a new inode.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @return File descriptor holding the lock, -1 on failure
+ */
+int lock_writer(const std::string& hty_file_path) {
+    std::string lock_path = hty_file_path + WRITER_LOCK_SUFFIX;
+    int fd = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open lock file: " << lock_path << std::endl;
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        std::cerr << "Error: Unable to lock file: " << lock_path << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Releases a lock taken with lock_writer
+ * @param[in] fd File descriptor returned by lock_writer
+ */
+void unlock_writer(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/**
+ * @brief Computes the CRC-32 (IEEE) of a buffer
+ * @param[in] data Bytes to checksum
+ * @param[in] size Number of bytes
+ * @return Checksum value
+ */
+uint32_t crc32(const char* data, size_t size) {
+    static uint32_t table[256];
+    static bool initialized = false;
+    if (!initialized) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        initialized = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * @brief Opens the write-ahead log of an HTY file and locks it
+ *
+ * A missing or empty log is initialized to describe the HTY file as it is
+ * now. The log lock only guards the log itself and is held briefly.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[out] header Header read under the lock
+ * @return Locked log descriptor, -1 on failure
+ */
+int open_wal(const std::string& hty_file_path, WalHeader& header) {
+    std::string wal_path = hty_file_path + WAL_SUFFIX;
+    int wal_fd = open(wal_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (wal_fd < 0 || flock(wal_fd, LOCK_EX) != 0) {
+        std::cerr << "Error: Unable to open log: " << wal_path << std::endl;
+        if (wal_fd >= 0) {
+            close(wal_fd);
+        }
+        return -1;
+    }
+
+    if (pread(wal_fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) == 0) {
+        return wal_fd;
+    }
+
+    struct stat hty_stat;
+    if (stat(hty_file_path.c_str(), &hty_stat) != 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        close(wal_fd);
+        return -1;
+    }
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.base_lsn = 0;
+    header.committed_length = hty_stat.st_size;
+    header.inode = hty_stat.st_ino;
+    if (ftruncate(wal_fd, 0) != 0 ||
+        !write_all(wal_fd, reinterpret_cast<const char*>(&header), sizeof(header), 0) ||
+        fdatasync(wal_fd) != 0) {
+        std::cerr << "Error: Unable to initialize log: " << wal_path << std::endl;
+        close(wal_fd);
+        return -1;
+    }
+    return wal_fd;
+}
+
+/**
+ * @brief Unlocks and closes a log opened with open_wal
+ * @param[in] wal_fd Descriptor returned by open_wal
+ */
+void close_wal(int wal_fd) {
+    flock(wal_fd, LOCK_UN);
+    close(wal_fd);
+}
+
+/**
+ * @brief Computes the checksum of a log record
+ * @param[in] record Record header; its checksum field is ignored
+ * @param[in] payload Record payload
+ * @return CRC-32 of the header with a zero checksum, followed by the payload
+ */
+uint32_t wal_record_checksum(WalRecordHeader record, const std::string& payload) {
+    record.checksum = 0;
+    std::string bytes(reinterpret_cast<const char*>(&record), sizeof(record));
+    return crc32((bytes + payload).data(), sizeof(record) + payload.size());
+}
+
+/**
+ * @brief Logs a batch of rows without syncing
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] batch Rows to log
+ * @return Log position of the record, -1 on failure
+ */
+long long wal_append(const std::string& hty_file_path, const RowBatch& batch) {
+    std::string payload;
+    for (const auto& slice : batch.groups) {
+        payload.append(reinterpret_cast<const char*>(slice.data()), slice.size() * sizeof(float));
+    }
+
+    WalHeader header;
+    int wal_fd = open_wal(hty_file_path, header);
+    if (wal_fd < 0) {
+        return -1;
+    }
+    struct stat wal_stat;
+    if (fstat(wal_fd, &wal_stat) != 0) {
+        std::cerr << "Error: Unable to read log size" << std::endl;
+        close_wal(wal_fd);
+        return -1;
+    }
+    long long offset = wal_stat.st_size;
+    WalRecordHeader record = {WAL_RECORD_MAGIC, static_cast<uint32_t>(batch.num_rows),
+                              payload.size(), 0, 0, 0};
+    record.lsn = header.base_lsn + offset + sizeof(record) + payload.size() - sizeof(WalHeader);
+    record.checksum = wal_record_checksum(record, payload);
+    bool success = write_all(wal_fd, reinterpret_cast<const char*>(&record), sizeof(record),
+                             offset) &&
+                   write_all(wal_fd, payload.data(), payload.size(), offset + sizeof(record));
+    close_wal(wal_fd);
+
+    if (!success) {
+        std::cerr << "Error: Unable to write log record" << std::endl;
+        return -1;
+    }
+    return record.lsn;
+}
+
+/**
+ * @brief Records a newly published HTY file length in the log header
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] length Length of the HTY file including its new footer
+ * @return true on success, false otherwise
+ */
+bool publish_commit(const std::string& hty_file_path, long long length) {
+    WalHeader header;
+    int wal_fd = open_wal(hty_file_path, header);
+    if (wal_fd < 0) {
+        return false;
+    }
+
+    struct stat hty_stat;
+    if (stat(hty_file_path.c_str(), &hty_stat) != 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        close_wal(wal_fd);
+        return false;
+    }
+    header.committed_length = length;
+    header.inode = hty_stat.st_ino;
+    bool success = write_all(wal_fd, reinterpret_cast<const char*>(&header), sizeof(header), 0) &&
+                   fdatasync(wal_fd) == 0;
+    close_wal(wal_fd);
+    return success;
+}
+
+/**
+ * @brief Appends a delta and a new footer to an HTY file and publishes it
+ *
+ * The new rows are written after the current footer, one row-major block
+ * per group, followed by the deletion vector if it changed and a footer
+ * that lists the blocks as extra segments. The previous footer is left
+ * intact, so until the new file length is published in the log a crash
+ * rolls back to it. Existing raw data is never touched, so the cost is
+ * proportional to the size of the delta rather than the file. Spooled
+ * rows are copied in ahead of the batch, into the same segment. The
+ * caller must hold the writer lock.
+ *
+ * @param[in] hty_file_path Path to the HTY file to modify
+ * @param[in] current Metadata read under the writer lock
+ * @param[in] batch Rows to append, possibly none
+ * @param[in] deleted New deletion vector, nullptr to keep the current one
+ * @param[in] wal_lsn Log position the delta covers, -1 to keep the current one
+ * @param[in] spool_fds Per-group files of rows laid out as on disk, empty if none
+ * @param[in] spool_rows Number of spooled rows
+ * @return true on success, false otherwise
+ */
+bool write_delta(const std::string& hty_file_path,
+                 const json& current,
+                 const RowBatch& batch,
+                 const std::vector<uint64_t>* deleted,
+                 long long wal_lsn,
+                 const std::vector<int>& spool_fds = {},
+                 long long spool_rows = 0) {
+    int fd = open(hty_file_path.c_str(), O_RDWR);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        return false;
+    }
+
+    bool success = true;
+    try {
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            throw std::runtime_error("Unable to read size of " + hty_file_path);
+        }
+        long long current_offset = file_stat.st_size;
+
+        long long added_rows = spool_rows + batch.num_rows;
+        json new_metadata = current;
+        new_metadata["num_rows"] = current["num_rows"].get<long long>() + added_rows;
+        if (wal_lsn >= 0) {
+            new_metadata["wal_lsn"] = wal_lsn;
+        }
+        {
+            std::ifstream input_stream(hty_file_path, std::ios::binary);
+            success = update_sort_order(current, input_stream, new_metadata, spool_fds,
+                                        spool_rows, batch) &&
+                      fold_statistics(new_metadata, spool_fds, spool_rows, batch);
+        }
+
+        for (int group_idx = 0; group_idx < current["num_groups"] && added_rows > 0;
+             ++group_idx) {
+            auto& new_group = new_metadata["groups"][group_idx];
+
+            // Make the implicit base segment explicit before adding the delta
+            if (!new_group.contains("segments")) {
+                new_group["segments"] = json::array();
+                for (const auto& segment : get_group_segments(current, group_idx)) {
+                    json entry = {{"offset", segment.offset}, {"num_rows", segment.num_rows}};
+                    if (!segment.zones.is_null()) {
+                        entry["zones"] = segment.zones;
+                    }
+                    new_group["segments"].push_back(entry);
+                }
+                new_group.erase("zones");
+            }
+
+            // Spooled rows and the group's slice are already laid out as on disk
+            int num_columns = new_group["num_columns"];
+            long long segment_offset = current_offset;
+            if (spool_rows > 0) {
+                long long spool_size = spool_rows * num_columns * sizeof(float);
+                success = success && copy_range(spool_fds[group_idx], 0, fd, current_offset,
+                                                spool_size);
+                current_offset += spool_size;
+            }
+            if (batch.num_rows > 0) {
+                const auto& slice = batch.groups[group_idx];
+                size_t slice_size = slice.size() * sizeof(float);
+                success = success && write_all(fd, reinterpret_cast<const char*>(slice.data()),
+                                               slice_size, current_offset);
+                current_offset += slice_size;
+            }
+
+            std::vector<ZoneMap> zones(num_columns);
+            success = success && scan_added_rows(spool_fds, spool_rows, batch, group_idx,
+                                                 num_columns,
+                                                 [&](const float* rows, long long count) {
+                json block = row_major_zones(new_group["columns"], rows, count);
+                for (int col = 0; col < num_columns; ++col) {
+                    zones[col].merge(zone_from_entry(block[col]));
+                }
+            });
+            json zone_entries = json::array();
+            for (const auto& zone : zones) {
+                zone_entries.push_back(zone.entry());
+            }
+            new_group["segments"].push_back({{"offset", segment_offset},
+                                             {"num_rows", added_rows},
+                                             {"zones", zone_entries}});
+        }
+
+        // The old deletion vector, if any, becomes dead space until compaction
+        if (deleted != nullptr) {
+            long long num_deleted = 0;
+            for (uint64_t word : *deleted) {
+                num_deleted += __builtin_popcountll(word);
+            }
+            size_t vector_size = deleted->size() * sizeof(uint64_t);
+            success = success && write_all(fd, reinterpret_cast<const char*>(deleted->data()),
+                                           vector_size, current_offset);
+            new_metadata["deletion_vector"] = {{"offset", current_offset},
+                                               {"num_words", deleted->size()},
+                                               {"num_deleted", num_deleted}};
+            current_offset += vector_size;
+        }
+
+        std::string footer = serialize_footer(new_metadata);
+        success = success && write_all(fd, footer.data(), footer.size(), current_offset) &&
+                  fdatasync(fd) == 0 &&
+                  publish_commit(hty_file_path, current_offset + footer.size());
+        if (!success) {
+            std::cerr << "Error: Unable to write delta to " << hty_file_path << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        success = false;
+    }
+
+    close(fd);
+    return success;
+}
+
+/**
+ * @brief Recovers an HTY file and applies every logged batch not yet in it
+ *
+ * First cuts off any bytes past the last published footer, left by a
+ * writer that crashed mid-append. Then, unless the footer already covers
+ * min_lsn, the caller becomes the group-commit leader: one sync makes
+ * every logged record durable, all pending records are applied as a
+ * single delta segment, and the log is truncated once fully applied. The
+ * caller must hold the writer lock.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] min_lsn Log position of a record that must be applied on return, 0 for none
+ * @return true if the record at min_lsn is applied, false otherwise
+ */
+bool commit_wal(const std::string& hty_file_path, long long min_lsn) {
+    WalHeader header;
+    int wal_fd = open_wal(hty_file_path, header);
+    if (wal_fd < 0) {
+        return false;
+    }
+
+    // Roll back an unpublished append; a new inode means a finished rewrite
+    struct stat hty_stat;
+    if (stat(hty_file_path.c_str(), &hty_stat) != 0) {
+        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
+        close_wal(wal_fd);
+        return false;
+    }
+    if (hty_stat.st_ino != header.inode ||
+        hty_stat.st_size < static_cast<off_t>(header.committed_length)) {
+        header.committed_length = hty_stat.st_size;
+        header.inode = hty_stat.st_ino;
+        if (!write_all(wal_fd, reinterpret_cast<const char*>(&header), sizeof(header), 0)) {
+            std::cerr << "Error: Unable to update log of " << hty_file_path << std::endl;
+            close_wal(wal_fd);
+            return false;
+        }
+    } else if (hty_stat.st_size > static_cast<off_t>(header.committed_length)) {
+        if (truncate(hty_file_path.c_str(), header.committed_length) != 0) {
+            std::cerr << "Error: Unable to roll back " << hty_file_path << std::endl;
+            close_wal(wal_fd);
+            return false;
+        }
+    }
+
+    json current = extract_metadata(hty_file_path);
+    if (current.empty()) {
+        close_wal(wal_fd);
+        return false;
+    }
+    long long applied_lsn = current.value("wal_lsn", 0LL);
+    if (applied_lsn < static_cast<long long>(header.base_lsn)) {
+        applied_lsn = header.base_lsn;
+    }
+
+    // Read the pending part of the log
+    struct stat wal_stat;
+    long long start = applied_lsn - header.base_lsn + sizeof(WalHeader);
+    std::string log;
+    if (fstat(wal_fd, &wal_stat) != 0) {
+        std::cerr << "Error: Unable to read log of " << hty_file_path << std::endl;
+        close_wal(wal_fd);
+        return false;
+    }
+    if (start < wal_stat.st_size) {
+        log.resize(wal_stat.st_size - start);
+        if (!read_all(wal_fd, log.data(), log.size(), start)) {
+            std::cerr << "Error: Unable to read log of " << hty_file_path << std::endl;
+            close_wal(wal_fd);
+            return false;
+        }
+    }
+
+    // Collect the pending records. A record torn by a crashed appender is
+    // stepped over by searching for the next valid one, so records other
+    // appenders logged after it survive. Records the footer already covers
+    // are skipped by their own LSN, since a cut-short checkpoint can leave
+    // applied records behind a moved base_lsn
+    uint64_t row_bytes = 0;
+    for (const auto& group : current["groups"]) {
+        row_bytes += group["num_columns"].get<uint64_t>() * sizeof(float);
+    }
+    RowBatch batch = make_batch(current, 0);
+    bool covered = min_lsn <= applied_lsn;
+    size_t offset = 0, end = 0;
+    const uint32_t record_magic = WAL_RECORD_MAGIC;
+    std::string payload;
+    while (offset + sizeof(WalRecordHeader) <= log.size()) {
+        WalRecordHeader record;
+        std::memcpy(&record, log.data() + offset, sizeof(record));
+        bool valid = record.magic == WAL_RECORD_MAGIC &&
+                     record.payload_size == record.num_rows * row_bytes &&
+                     record.payload_size <= log.size() - offset - sizeof(record);
+        if (valid) {
+            payload.assign(log, offset + sizeof(record), record.payload_size);
+            valid = wal_record_checksum(record, payload) == record.checksum;
+        }
+        if (!valid) {
+            offset = log.find(std::string(reinterpret_cast<const char*>(&record_magic),
+                                          sizeof(record_magic)), offset + 1);
+            offset = std::min(offset, log.size());
+            continue;
+        }
+        offset += sizeof(record) + record.payload_size;
+        end = offset;
+        if (static_cast<long long>(record.lsn) <= applied_lsn) {
+            continue;
+        }
+        covered = covered || static_cast<long long>(record.lsn) == min_lsn;
+        const float* values = reinterpret_cast<const float*>(payload.data());
+        for (size_t g = 0; g < batch.groups.size(); ++g) {
+            size_t count = static_cast<size_t>(record.num_rows) *
+                           current["groups"][g]["num_columns"].get<int>();
+            batch.groups[g].insert(batch.groups[g].end(), values, values + count);
+            values += count;
+        }
+        batch.num_rows += record.num_rows;
+    }
+
+    // Only bytes past the last valid record are cut off
+    if (end < log.size() && ftruncate(wal_fd, start + end) != 0) {
+        std::cerr << "Error: Unable to truncate log of " << hty_file_path << std::endl;
+        close_wal(wal_fd);
+        return false;
+    }
+    long long target_lsn = applied_lsn + static_cast<long long>(end);
+    if (!covered) {
+        std::cerr << "Error: Log record " << min_lsn << " of " << hty_file_path
+                  << " is missing" << std::endl;
+    }
+
+    // Nothing pending: a previous leader already applied our record
+    if (batch.num_rows == 0) {
+        close_wal(wal_fd);
+        return covered;
+    }
+
+    // One sync makes every collected record durable; then let appenders in
+    bool success = fdatasync(wal_fd) == 0;
+    close_wal(wal_fd);
+    success = success && write_delta(hty_file_path, current, batch, nullptr, target_lsn);
+    if (!success) {
+        return false;
+    }
+
+    // Checkpoint: drop the log once nothing was appended behind us. The
+    // rows are already committed, so a failed checkpoint only leaves a
+    // longer log whose records replay skips by LSN
+    wal_fd = open_wal(hty_file_path, header);
+    if (wal_fd < 0) {
+        return covered;
+    }
+    if (fstat(wal_fd, &wal_stat) == 0 &&
+        header.base_lsn + wal_stat.st_size - sizeof(WalHeader) ==
+            static_cast<uint64_t>(target_lsn)) {
+        header.base_lsn = target_lsn;
+        if (!write_all(wal_fd, reinterpret_cast<const char*>(&header), sizeof(header), 0) ||
+            fdatasync(wal_fd) != 0 || ftruncate(wal_fd, sizeof(WalHeader)) != 0 ||
+            fdatasync(wal_fd) != 0) {
+            std::cerr << "Error: Unable to checkpoint log of " << hty_file_path << std::endl;
+        }
+    }
+    close_wal(wal_fd);
+    return covered;
+}
+
+/**
+ * @brief Checks whether delta segments have piled up enough to compact
+ * @param[in] metadata JSON metadata of the HTY file
+ * @return true if a segment count or delta size threshold is exceeded
+ */
+bool needs_compaction(const json& metadata) {
+    long long delta_bytes = 0;
+    for (int group_idx = 0; group_idx < metadata["num_groups"]; ++group_idx) {
+        const auto& group = metadata["groups"][group_idx];
+        auto segments = get_group_segments(metadata, group_idx);
+
+        // Columnar blocks are the base of their group; only row-major deltas count
+        size_t first_delta = is_columnar_group(group) ? 0 : 1;
+        size_t num_deltas = 0;
+        int group_columns = group["num_columns"];
+        for (size_t i = first_delta; i < segments.size(); ++i) {
+            if (segments[i].chunks.is_null()) {
+                ++num_deltas;
+                delta_bytes += static_cast<long long>(segments[i].num_rows) *
+                               group_columns * sizeof(float);
+            }
+        }
+        if (num_deltas + 1 > COMPACT_MAX_SEGMENTS) {
+            return true;
+        }
+    }
+    if (metadata.contains("deletion_vector") &&
+        metadata["deletion_vector"]["num_deleted"].get<double>() >
+            COMPACT_MAX_DELETED_RATIO * metadata["num_rows"].get<double>()) {
+        return true;
+    }
+    return delta_bytes > COMPACT_MAX_DELTA_BYTES;
+}
+
+/**
+ * @brief Builds the secondary index of a column in a sidecar file
+ *
+ * Indexes the live, non-null rows of the snapshot as (value, row id)
+ * entries sorted by value, followed by one fence key per page. The file
+ * is written under a temporary name and renamed into place.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column_name Name of the column to index
+ * @return Number of entries written, -1 on failure
+ */
+long long build_index(const std::string& hty_file_path, const std::string& column_name) {
+    Snapshot snapshot;
+    json metadata = extract_metadata(hty_file_path, &snapshot);
+    if (metadata.empty()) {
+        return -1;
+    }
+    auto [group_index, column_index] = get_column_info(metadata, column_name);
+    if (group_index == -1) {
+        return -1;
+    }
+
+    std::vector<IndexEntry> entries;
+    {
+        std::ifstream file = open_snapshot(snapshot, hty_file_path);
+        auto values = read_column(metadata, file, group_index, column_index);
+        auto live = load_live_rows(metadata, file);
+        for (size_t row = 0; row < values.size(); ++row) {
+            if (!std::isnan(values[row]) && (live.empty() || test_bit(live, row))) {
+                entries.push_back({values[row], static_cast<uint32_t>(row)});
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        return a.value < b.value || (a.value == b.value && a.row < b.row);
+    });
+
+    std::vector<float> fences;
+    for (size_t i = 0; i < entries.size(); i += INDEX_PAGE_ENTRIES) {
+        fences.push_back(entries[i].value);
+    }
+    IndexHeader header = {};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.file_id = metadata.value("file_id", 0ULL);
+    header.generation = metadata.value("generation", 0ULL);
+    header.num_rows = metadata["num_rows"].get<uint64_t>();
+    header.num_entries = entries.size();
+    header.page_entries = INDEX_PAGE_ENTRIES;
+    header.name_size = column_name.size();
+
+    std::string path = index_path(hty_file_path, column_name);
+    std::string tmp_path = path + REWRITE_TMP_SUFFIX;
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open index file: " << tmp_path << std::endl;
+        return -1;
+    }
+    long long offset = 0;
+    bool success = true;
+    auto append = [&](const void* data, size_t size) {
+        success = success && write_all(fd, static_cast<const char*>(data), size, offset);
+        offset += size;
+    };
+    append(&header, sizeof(header));
+    append(column_name.data(), column_name.size());
+    append(entries.data(), entries.size() * sizeof(IndexEntry));
+    append(fences.data(), fences.size() * sizeof(float));
+    success = success && fdatasync(fd) == 0;
+    close(fd);
+    if (!success || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error: Unable to write index file: " << path << std::endl;
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+    return entries.size();
+}
+
+/**
+ * @brief Builds the bitmap index of a low-cardinality column in a sidecar file
+ *
+ * Stores, for each distinct value of the snapshot's live, non-null rows,
+ * the compressed bitmap of the rows holding it. The file is written under
+ * a temporary name and renamed into place.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] column_name Name of the column to index
+ * @return Number of distinct values indexed, -1 on failure
+ */
+long long build_bitmap_index(const std::string& hty_file_path, const std::string& column_name) {
+    Snapshot snapshot;
+    json metadata = extract_metadata(hty_file_path, &snapshot);
+    if (metadata.empty()) {
+        return -1;
+    }
+    auto [group_index, column_index] = get_column_info(metadata, column_name);
+    if (group_index == -1) {
+        return -1;
+    }
+
+    // Rows of each distinct value, ascending since rows are visited in order
+    std::map<float, std::vector<uint32_t>> rows_by_value;
+    {
+        std::ifstream file = open_snapshot(snapshot, hty_file_path);
+        auto values = read_column(metadata, file, group_index, column_index);
+        auto live = load_live_rows(metadata, file);
+        for (size_t row = 0; row < values.size(); ++row) {
+            if (std::isnan(values[row]) || (!live.empty() && !test_bit(live, row))) {
+                continue;
+            }
+            rows_by_value[values[row] == 0.0f ? 0.0f : values[row]].push_back(row);
+            if (rows_by_value.size() > BITMAP_INDEX_MAX_VALUES) {
+                std::cerr << "Error: Column " << column_name << " has more than "
+                          << BITMAP_INDEX_MAX_VALUES << " distinct values" << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    BitmapIndexHeader header = {};
+    std::memcpy(header.magic, BITMAP_INDEX_MAGIC, sizeof(header.magic));
+    header.file_id = metadata.value("file_id", 0ULL);
+    header.generation = metadata.value("generation", 0ULL);
+    header.num_rows = metadata["num_rows"].get<uint64_t>();
+    header.num_values = rows_by_value.size();
+    header.name_size = column_name.size();
+
+    std::vector<BitmapIndexValue> values;
+    std::string bitmaps;
+    uint64_t bitmaps_offset = sizeof(header) + column_name.size() +
+                              rows_by_value.size() * sizeof(BitmapIndexValue);
+    for (const auto& [value, rows] : rows_by_value) {
+        std::string bitmap = roaring_encode(rows);
+        values.push_back({value, static_cast<uint32_t>(rows.size()),
+                          bitmaps_offset + bitmaps.size(), bitmap.size()});
+        bitmaps += bitmap;
+    }
+
+    std::string path = index_path(hty_file_path, column_name, BITMAP_INDEX_SUFFIX);
+    std::string tmp_path = path + REWRITE_TMP_SUFFIX;
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open index file: " << tmp_path << std::endl;
+        return -1;
+    }
+    long long offset = 0;
+    bool success = true;
+    auto append = [&](const void* data, size_t size) {
+        success = success && write_all(fd, static_cast<const char*>(data), size, offset);
+        offset += size;
+    };
+    append(&header, sizeof(header));
+    append(column_name.data(), column_name.size());
+    append(values.data(), values.size() * sizeof(BitmapIndexValue));
+    append(bitmaps.data(), bitmaps.size());
+    success = success && fdatasync(fd) == 0;
+    close(fd);
+    if (!success || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error: Unable to write index file: " << path << std::endl;
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+    return values.size();
+}
+
+/**
+ * @brief Rebuilds every secondary and bitmap index of an HTY file
+ *
+ * A rewrite renumbers rows, so the indexes found next to the file are
+ * built again for its new generation.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ */
+void rebuild_indexes(const std::string& hty_file_path) {
+    std::filesystem::path path = std::filesystem::absolute(hty_file_path);
+    std::string prefix = path.filename().string() + ".";
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(path.parent_path(), error)) {
+        std::string name = entry.path().filename().string();
+        std::string suffix = entry.path().extension().string();
+        if (name.rfind(prefix, 0) != 0 || name.size() <= prefix.size() + suffix.size() ||
+            (suffix != INDEX_SUFFIX && suffix != BITMAP_INDEX_SUFFIX)) {
+            continue;
+        }
+
+        // The header names the column; sanitized file names may not
+        std::ifstream index(entry.path(), std::ios::binary);
+        IndexHeader header;
+        BitmapIndexHeader bitmap_header;
+        std::string column_name;
+        if (suffix == INDEX_SUFFIX &&
+            index.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+            std::memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0) {
+            column_name.resize(header.name_size);
+        } else if (suffix == BITMAP_INDEX_SUFFIX &&
+                   index.read(reinterpret_cast<char*>(&bitmap_header), sizeof(bitmap_header)) &&
+                   std::memcmp(bitmap_header.magic, BITMAP_INDEX_MAGIC,
+                               sizeof(bitmap_header.magic)) == 0) {
+            column_name.resize(bitmap_header.name_size);
+        } else {
+            continue;
+        }
+        index.read(column_name.data(), column_name.size());
+        index.close();
+        if (suffix == INDEX_SUFFIX) {
+            build_index(hty_file_path, column_name);
+        } else {
+            build_bitmap_index(hty_file_path, column_name);
+        }
+    }
+}
+
+/**
+ * @brief Merges all delta segments back into contiguous column groups
+ *
+ * Runs under the writer lock against freshly read metadata. Compacting in
+ * place writes a temporary file and renames it over the original.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] output_path Destination path, empty to compact in place
+ * @param[in] only_if_needed Skip the rewrite when no threshold is exceeded
+ * @return true on success, false otherwise
+ */
+bool compact(const std::string& hty_file_path,
+             const std::string& output_path,
+             bool only_if_needed) {
+    int lock_fd = lock_writer(hty_file_path);
+    if (lock_fd < 0) {
+        return false;
+    }
+
+    // Fold in appends still pending in the log before reading the footer
+    json metadata;
+    if (commit_wal(hty_file_path, 0)) {
+        metadata = extract_metadata(hty_file_path);
+    }
+    if (metadata.empty()) {
+        unlock_writer(lock_fd);
+        return false;
+    }
+    if (only_if_needed && !needs_compaction(metadata)) {
+        unlock_writer(lock_fd);
+        return true;
+    }
+
+    bool in_place = output_path.empty() || output_path == hty_file_path;
+    std::string target = in_place ? hty_file_path : output_path;
+    bool success = rewrite_file(metadata, Snapshot(), hty_file_path, target, RowBatch(), {}, true);
+
+    // The log must now describe the new inode
+    if (success && in_place) {
+        success = publish_commit(hty_file_path, std::filesystem::file_size(hty_file_path));
+    }
+
+    unlock_writer(lock_fd);
+    if (success && in_place) {
+        rebuild_indexes(hty_file_path);
+    }
+    return success;
+}
+
+/**
+ * @brief Starts a detached in-place compaction if thresholds are exceeded
+ *
+ * The compaction runs in a double-forked process so the caller returns
+ * immediately and never has to reap it.
+ *
+ * @param[in] hty_file_path Path to the HTY file
+ */
+void compact_in_background(const std::string& hty_file_path) {
+    json metadata = extract_metadata(hty_file_path);
+    if (metadata.empty() || !needs_compaction(metadata)) {
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Error: Unable to start background compaction" << std::endl;
+        return;
+    }
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    // Intermediate child: hand the work to a grandchild and exit at once
+    if (fork() != 0) {
+        _exit(0);
+    }
+    setsid();
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    _exit(compact(hty_file_path, "", true) ? 0 : 1);
+}
+
+/**
+ * @brief Appends a batch to an HTY file in place as a delta segment
+ *
+ * The batch is first logged; the writer that next takes the writer lock
+ * applies every logged batch at once with a single sync of the log.
+ *
+ * @param[in] hty_file_path Path to the HTY file to modify
+ * @param[in] batch Rows to append, split by group
+ * @return true on success, false otherwise
+ */
+bool append_batch(const std::string& hty_file_path, const RowBatch& batch) {
+    long long lsn = wal_append(hty_file_path, batch);
+    if (lsn < 0) {
+        return false;
+    }
+
+    int lock_fd = lock_writer(hty_file_path);
+    if (lock_fd < 0) {
+        return false;
+    }
+    bool success = commit_wal(hty_file_path, lsn);
+
+    unlock_writer(lock_fd);
+    return success;
+}
+
+/**
+ * @brief Deletes, and optionally rewrites, the rows matching a filter
+ *
+ * Matching rows are marked in the deletion vector. For an update, their
+ * full contents are read back, the assigned column is overwritten, and
+ * the replacement rows are appended as a delta segment in the same footer
+ * write, so readers see either the old rows or the new ones.
+ *
+ * @param[in] hty_file_path Path to the HTY file to modify
+ * @param[in] filtered_column Name of the column to filter on
+ * @param[in] op Filter operation to apply
+ * @param[in] value Filter value to compare against
+ * @param[in] set_column Column to assign for an update, empty for a delete
+ * @param[in] set_value Value assigned to set_column
+ * @return Number of rows affected, -1 on failure
+ */
+long long delete_or_update(const std::string& hty_file_path,
+                           const std::string& filtered_column,
+                           int op,
+                           float value,
+                           const std::string& set_column,
+                           float set_value) {
+    int lock_fd = lock_writer(hty_file_path);
+    if (lock_fd < 0) {
+        return -1;
+    }
+    json current;
+    if (commit_wal(hty_file_path, 0)) {
+        current = extract_metadata(hty_file_path);
     }
-    
-    // Open file
     std::ifstream file(hty_file_path, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error: Unable to open file: " << hty_file_path << std::endl;
-        return result;
+    auto [group_index, column_index] = current.empty() ? std::pair<int, int>{-1, -1}
+                                       : get_column_info(current, filtered_column);
+    int set_group = -1, set_index = -1;
+    if (group_index != -1 && !set_column.empty()) {
+        std::tie(set_group, set_index) = get_column_info(current, set_column);
     }
-    
-    const auto& group = metadata["groups"][group_index];
-    int num_rows = metadata["num_rows"];
-    int offset = group["offset"];
-    int num_columns = group["num_columns"];
-    
-    // Get column indices
-    std::vector<int> proj_indices;
-    for (const auto& col_name : projected_columns) {
-        auto [_, col_idx] = get_column_info(metadata, col_name);
-        proj_indices.push_back(col_idx);
+    bool set_fits = set_group == -1 ||
+                    check_column_value(current["groups"][set_group]["columns"][set_index],
+                                       set_value, -1);
+    if (!file.is_open() || group_index == -1 || (!set_column.empty() && set_group == -1) ||
+        !set_fits) {
+        unlock_writer(lock_fd);
+        return -1;
     }
-    
-    auto [_, filter_col_idx] = get_column_info(metadata, filtered_column);
-    
-    // Initialize result vectors (will resize as we find matching rows)
-    result.resize(projected_columns.size());
-    
-    // Read and filter data
-    float filter_value, proj_value;
-    for (int row = 0; row < num_rows; ++row) {
-        // Read filter column value
-        file.seekg(offset + (row * num_columns + filter_col_idx) * sizeof(float));
-        file.read(reinterpret_cast<char*>(&filter_value), sizeof(float));
-        
-        // Check if row passes filter
-        if (apply_filter(filter_value, op, value)) {
-            // Read all projected columns for this row
-            for (size_t i = 0; i < proj_indices.size(); ++i) {
-                file.seekg(offset + (row * num_columns + proj_indices[i]) * sizeof(float));
-                file.read(reinterpret_cast<char*>(&proj_value), sizeof(float));
-                result[i].push_back(proj_value);
+
+    // Matching rows that are still live
+    auto selection = evaluate_filter(current, file, hty_file_path, group_index, column_index,
+                                     op, value);
+    auto live = load_live_rows(current, file);
+    if (!live.empty()) {
+        and_bitmaps(selection.data(), live.data(), selection.size());
+    }
+    long long affected = 0;
+    for (uint64_t word : selection) {
+        affected += __builtin_popcountll(word);
+    }
+
+    // Fold them into the deletion vector, grown to cover appended rows
+    auto deleted = load_deleted_rows(current, file);
+    deleted.resize(selection.size(), 0);
+    for (size_t i = 0; i < selection.size(); ++i) {
+        deleted[i] |= selection[i];
+    }
+
+    // Read back the full replacement rows for an update
+    RowBatch batch = make_batch(current, 0);
+    if (!set_column.empty() && affected > 0) {
+        for (int group_idx = 0; group_idx < current["num_groups"]; ++group_idx) {
+            int group_columns = current["groups"][group_idx]["num_columns"];
+            std::vector<int> all_columns(group_columns);
+            for (int col = 0; col < group_columns; ++col) {
+                all_columns[col] = col;
+            }
+            std::vector<std::vector<float>> columns;
+            if (!gather_rows(current, Snapshot(), file, hty_file_path, group_idx, all_columns,
+                             selection, columns)) {
+                unlock_writer(lock_fd);
+                return -1;
+            }
+            if (group_idx == set_group) {
+                std::fill(columns[set_index].begin(), columns[set_index].end(), set_value);
+            }
+            for (long long row = 0; row < affected; ++row) {
+                for (int col = 0; col < group_columns; ++col) {
+                    batch.groups[group_idx].push_back(columns[col][row]);
+                }
             }
         }
+        batch.num_rows = affected;
+        store_batch(current, batch);
     }
-    
     file.close();
-    return result;
+
+    bool success = affected == 0 || write_delta(hty_file_path, current, batch, &deleted, -1);
+    unlock_writer(lock_fd);
+    return success ? affected : -1;
 }
 
 /**
- * @brief Displays multiple columns of data
+ * @brief Appends rows to an HTY file in place as a delta segment
  * @param[in] metadata JSON metadata of the HTY file
- * @param[in] column_names Names of the columns to display
- * @param[in] result_set Vector of vectors containing the column values
+ * @param[in] hty_file_path Path to the HTY file to modify
+ * @param[in] rows Vector of vectors containing new row data
+ * @return true on success, false otherwise
  */
-void display_result_set(const json& metadata,
-                       const std::vector<std::string>& column_names,
-                       const std::vector<std::vector<float>>& result_set) {
-    if (result_set.empty() || column_names.empty()) return;
-    
-    // Print header
-    for (size_t i = 0; i < column_names.size(); ++i) {
-        std::cout << column_names[i];
-        if (i < column_names.size() - 1) std::cout << ",";
+bool append_row(const json& metadata,
+                const std::string& hty_file_path,
+                const std::vector<std::vector<float>>& rows) {
+    if (!validate_rows(metadata, rows)) {
+        return false;
     }
-    std::cout << std::endl;
-    
-    // Print data rows
-    for (size_t row = 0; row < result_set[0].size(); ++row) {
-        for (size_t col = 0; col < result_set.size(); ++col) {
-            std::cout << format_large_number(result_set[col][row]);
-            if (col < result_set.size() - 1) std::cout << ",";
+
+    return append_batch(hty_file_path, make_batch(metadata, rows));
+}
+
+/**
+ * @brief Parses one CSV line into the next row of a batch
+ *
+ * Mirrors the converter: a missing or non-numeric field is a null (NaN)
+ * in a columnar group and 0.0 in a row-major one, and fields beyond the
+ * file's column count are ignored.
+ *
+ * @param[in] group_columns Number of columns of each group
+ * @param[in] group_missing Value of a missing field in each group
+ * @param[in] line CSV line without its newline
+ * @param[in,out] batch Batch receiving the row
+ * @return false if a non-empty field is not a number, as in a header
+ */
+bool parse_csv_row(const std::vector<int>& group_columns,
+                   const std::vector<float>& group_missing, std::string_view line,
+                   RowBatch& batch) {
+    bool all_numbers = true;
+    size_t pos = 0;
+    for (size_t group_idx = 0; group_idx < batch.groups.size(); ++group_idx) {
+        for (int col = 0; col < group_columns[group_idx]; ++col) {
+            float value = group_missing[group_idx];
+            if (pos <= line.size()) {
+                size_t end = line.find(',', pos);
+                if (end == std::string_view::npos) {
+                    end = line.size();
+                }
+                const char* first = line.data() + pos;
+                const char* last = line.data() + end;
+                while (first < last && (*first == ' ' || *first == '+')) {
+                    ++first;
+                }
+                while (last > first && (last[-1] == ' ' || last[-1] == '\r')) {
+                    --last;
+                }
+                auto [ptr, error] = std::from_chars(first, last, value);
+                if (first == last) {
+                    value = group_missing[group_idx];
+                } else if (error != std::errc() || ptr != last) {
+                    all_numbers = false;
+                    value = group_missing[group_idx];
+                }
+                pos = end + 1;
+            }
+            batch.groups[group_idx].push_back(value);
         }
-        std::cout << std::endl;
     }
+    return all_numbers;
 }
 
 /**
- * @brief Validates row data against metadata requirements
+ * @brief Checks that every value of a parsed batch fits its column
  * @param[in] metadata JSON metadata of the HTY file
- * @param[in] rows Vector of row data to validate
- * @return true if valid, false otherwise
+ * @param[in] batch Batch holding values as seen through the API
+ * @param[in] first_row Input row number of the batch's first row
+ * @return true if every value fits, false otherwise
  */
-bool validate_rows(const json& metadata, const std::vector<std::vector<float>>& rows) {
-    if (rows.empty()) {
-        std::cerr << "Error: No rows provided" << std::endl;
-        return false;
-    }
-
-    int total_columns = 0;
-    for (const auto& group : metadata["groups"]) {
-        total_columns += group["num_columns"].get<int>();
-    }
-    
-    for (size_t i = 0; i < rows.size(); ++i) {
-        if (rows[i].size() != static_cast<size_t>(total_columns)) {
-            std::cerr << "Error: Row " << i << " has incorrect number of columns. "
-                     << "Expected: " << total_columns 
-                     << ", Got: " << rows[i].size() << std::endl;
-            return false;
+bool check_batch(const json& metadata, const RowBatch& batch, long long first_row) {
+    for (size_t group_idx = 0; group_idx < batch.groups.size(); ++group_idx) {
+        const auto& columns = metadata["groups"][group_idx]["columns"];
+        const auto& slice = batch.groups[group_idx];
+        for (size_t col = 0; col < columns.size(); ++col) {
+            if (!is_int_column(columns[col])) {
+                continue;
+            }
+            for (size_t i = col; i < slice.size(); i += columns.size()) {
+                if (!check_column_value(columns[col], slice[i],
+                                        first_row + i / columns.size())) {
+                    return false;
+                }
+            }
         }
     }
-    
     return true;
 }
 
 /**
- * @brief Adds new rows to HTY file
+ * @brief Streams rows from a CSV or raw binary file in columnar batches
+ *
+ * A binary source holds rows of little-endian 32-bit floats covering every
+ * column in file order. A CSV source may start with a header line, which
+ * is skipped. The first line is a header only if one of its fields is
+ * non-empty and not a number, since empty fields are nulls. Each full
+ * batch, and the final partial one, is handed to the consumer, so memory
+ * stays bounded by the batch size.
+ *
  * @param[in] metadata JSON metadata of the HTY file
- * @param[in] hty_file_path Path to the source HTY file
- * @param[in] modified_hty_file_path Path to the destination HTY file
- * @param[in] rows Vector of vectors containing new row data
+ * @param[in] source_path Path to the input rows
+ * @param[in] format Either "csv" or "bin"
+ * @param[in] consume Callback receiving each batch
+ * @return Number of rows ingested, -1 on failure
  */
-void add_row(const json& metadata, 
-             const std::string& hty_file_path,
-             const std::string& modified_hty_file_path,
-             const std::vector<std::vector<float>>& rows) {
-    // Validate input rows
-    if (!validate_rows(metadata, rows)) {
-        return;
+long long stream_batches(const json& metadata,
+                         const std::string& source_path,
+                         const std::string& format,
+                         const std::function<bool(const RowBatch&)>& consume) {
+    int total_columns = 0;
+    std::vector<int> group_columns;
+    std::vector<float> group_missing;
+    for (const auto& group : metadata["groups"]) {
+        group_columns.push_back(group["num_columns"].get<int>());
+        group_missing.push_back(is_columnar_group(group) ? NAN : 0.0f);
+        total_columns += group_columns.back();
     }
+    size_t row_size = total_columns * sizeof(float);
+    size_t batch_rows = std::max<size_t>(1, BULK_BATCH_BYTES / row_size);
 
-    // Open input file for reading
-    std::ifstream input_file(hty_file_path, std::ios::binary);
-    if (!input_file.is_open()) {
-        std::cerr << "Error: Unable to open input file: " << hty_file_path << std::endl;
-        return;
+    std::ifstream source(source_path, std::ios::binary);
+    if (!source.is_open()) {
+        std::cerr << "Error: Unable to open input file: " << source_path << std::endl;
+        return -1;
     }
-
-    // Open output file for writing
-    std::ofstream output_file(modified_hty_file_path, std::ios::binary | std::ios::trunc);
-    if (!output_file.is_open()) {
-        std::cerr << "Error: Unable to open output file: " << modified_hty_file_path << std::endl;
-        input_file.close();
-        return;
+    if (format != "csv" && format != "bin") {
+        std::cerr << "Error: Unknown input format: " << format << std::endl;
+        return -1;
     }
 
-    try {
-        // Create new metadata with updated row count
-        json new_metadata = metadata;
-        new_metadata["num_rows"] = metadata["num_rows"].get<int>() + rows.size();
-
-        // Copy existing data and add new rows, group by group
-        int current_offset = 0;
-        int total_groups = metadata["num_groups"];
-
-        for (int group_idx = 0; group_idx < total_groups; ++group_idx) {
-            const auto& group = metadata["groups"][group_idx];
-            int group_columns = group["num_columns"];
-            int group_offset = group["offset"];
-            
-            // Update offset in new metadata
-            new_metadata["groups"][group_idx]["offset"] = current_offset;
+    RowBatch batch = make_batch(metadata, batch_rows);
+    long long total_rows = 0;
+    std::vector<float> row_buffer;
+    std::string line;
+    bool first_line = true;
 
-            // Calculate starting column index for this group
-            int start_col = 0;
-            for (int i = 0; i < group_idx; ++i) {
-                start_col += metadata["groups"][i]["num_columns"].get<int>();
+    while (true) {
+        if (format == "csv") {
+            if (!std::getline(source, line)) {
+                break;
+            }
+            if (line.empty() || line == "\r") {
+                continue;
+            }
+            bool numeric = parse_csv_row(group_columns, group_missing, line, batch);
+            if (first_line && !numeric) {
+                // Header line: roll back the row just parsed
+                for (size_t g = 0; g < batch.groups.size(); ++g) {
+                    batch.groups[g].resize(batch.groups[g].size() - group_columns[g]);
+                }
+                first_line = false;
+                continue;
+            }
+            first_line = false;
+            ++batch.num_rows;
+        } else {
+            // Read the rest of a batch worth of rows in one call
+            row_buffer.resize((batch_rows - batch.num_rows) * total_columns);
+            source.read(reinterpret_cast<char*>(row_buffer.data()),
+                        row_buffer.size() * sizeof(float));
+            size_t bytes = source.gcount();
+            if (bytes % row_size != 0) {
+                std::cerr << "Error: Input size is not a multiple of the row size ("
+                          << row_size << " bytes)" << std::endl;
+                return -1;
+            }
+            size_t rows_read = bytes / row_size;
+            for (size_t row = 0; row < rows_read; ++row) {
+                const float* value = row_buffer.data() + row * total_columns;
+                for (size_t g = 0; g < batch.groups.size(); ++g) {
+                    batch.groups[g].insert(batch.groups[g].end(), value,
+                                           value + group_columns[g]);
+                    value += group_columns[g];
+                }
             }
+            batch.num_rows += rows_read;
+            if (rows_read == 0) {
+                break;
+            }
+        }
 
-            // Calculate group size
-            int group_size = metadata["num_rows"].get<int>() * group_columns * sizeof(float);
+        if (static_cast<size_t>(batch.num_rows) == batch_rows) {
+            if (!check_batch(metadata, batch, total_rows)) {
+                return -1;
+            }
+            store_batch(metadata, batch);
+            if (!consume(batch)) {
+                return -1;
+            }
+            total_rows += batch.num_rows;
+            batch.num_rows = 0;
+            for (auto& slice : batch.groups) {
+                slice.clear();
+            }
+        }
+    }
 
-            // Copy existing group data
-            input_file.seekg(group_offset);
-            std::vector<char> buffer(group_size);
-            input_file.read(buffer.data(), group_size);
-            output_file.write(buffer.data(), group_size);
+    if (batch.num_rows > 0) {
+        if (!check_batch(metadata, batch, total_rows)) {
+            return -1;
+        }
+        store_batch(metadata, batch);
+        if (!consume(batch)) {
+            return -1;
+        }
+        total_rows += batch.num_rows;
+    }
+    return total_rows;
+}
 
-            // Write new rows for this group
-            for (const auto& row : rows) {
-                for (int col = 0; col < group_columns; ++col) {
-                    float value = row[start_col + col];
-                    output_file.write(reinterpret_cast<const char*>(&value), sizeof(float));
-                }
+/**
+ * @brief Appends every row of a CSV or raw binary file to an HTY file
+ *
+ * Batches are spooled to one unlinked temporary file per group, so the
+ * whole input is parsed and checked before the file is touched. Without
+ * a destination, the spooled rows are then appended in place under the
+ * writer lock as one delta segment per group with a single footer
+ * publish, so an ingest that fails part way adds no rows. With one, the
+ * destination is assembled with zero-copy range copies, leaving every
+ * group contiguous.
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] snapshot Pinned version of the file to read
+ * @param[in] hty_file_path Path to the HTY file
+ * @param[in] source_path Path to the input rows
+ * @param[in] format Either "csv" or "bin"
+ * @param[in] modified_hty_file_path Destination path, empty to append in place
+ * @return true on success, false otherwise
+ */
+bool bulk_append(const json& metadata, const Snapshot& snapshot,
+                 const std::string& hty_file_path,
+                 const std::string& source_path,
+                 const std::string& format,
+                 const std::string& modified_hty_file_path) {
+    // One anonymous spool file per group, next to the destination
+    std::string spool_dir = std::filesystem::absolute(modified_hty_file_path.empty()
+                                                      ? hty_file_path : modified_hty_file_path)
+                                .parent_path().string();
+    std::vector<int> spool_fds;
+    for (size_t g = 0; g < metadata["groups"].size(); ++g) {
+        int fd = open(spool_dir.c_str(), O_TMPFILE | O_RDWR, 0600);
+        if (fd < 0) {
+            std::cerr << "Error: Unable to create spool file in " << spool_dir << std::endl;
+            for (int spool_fd : spool_fds) {
+                close(spool_fd);
             }
-
-            // Update offset for next group
-            current_offset += group_size + rows.size() * group_columns * sizeof(float);
+            return false;
         }
+        spool_fds.push_back(fd);
+    }
 
-        // Write new metadata
-        std::string metadata_str = new_metadata.dump();
-        output_file.write(metadata_str.c_str(), metadata_str.size());
+    std::vector<long long> spool_sizes(spool_fds.size(), 0);
+    long long rows = stream_batches(metadata, source_path, format,
+                                    [&](const RowBatch& batch) {
+        for (size_t g = 0; g < spool_fds.size(); ++g) {
+            const auto& slice = batch.groups[g];
+            size_t bytes = slice.size() * sizeof(float);
+            if (!write_all(spool_fds[g], reinterpret_cast<const char*>(slice.data()),
+                           bytes, spool_sizes[g])) {
+                std::cerr << "Error: Unable to write spool file" << std::endl;
+                return false;
+            }
+            spool_sizes[g] += bytes;
+        }
+        return true;
+    });
 
-        // Write metadata size
-        int metadata_size = static_cast<int>(metadata_str.size());
-        output_file.write(reinterpret_cast<const char*>(&metadata_size), sizeof(int));
+    bool success = rows >= 0;
+    if (success && modified_hty_file_path.empty() && rows > 0) {
+        int lock_fd = lock_writer(hty_file_path);
+        json current;
+        if (lock_fd >= 0 && commit_wal(hty_file_path, 0)) {
+            current = extract_metadata(hty_file_path);
+        }
+        success = !current.empty() &&
+                  write_delta(hty_file_path, current, make_batch(current, 0), nullptr, -1,
+                              spool_fds, rows);
+        if (lock_fd >= 0) {
+            unlock_writer(lock_fd);
+        }
+    } else if (success && !modified_hty_file_path.empty()) {
+        success = rewrite_file(metadata, snapshot, hty_file_path, modified_hty_file_path,
+                               RowBatch(), spool_fds);
+    }
+    for (int fd : spool_fds) {
+        close(fd);
+    }
+    return success;
+}
 
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        input_file.close();
-        output_file.close();
-        return;
+/**
+ * @brief Reads rows of values for every column from standard input
+ *
+ * Each value is a number, or `null` for a missing value (NaN).
+ *
+ * @param[in] metadata JSON metadata of the HTY file
+ * @param[in] num_rows Number of rows to read
+ * @param[out] rows Vector receiving the parsed rows
+ * @return true on success, false if the input ended early or a value is not a number
+ */
+bool read_rows(const json& metadata, int num_rows, std::vector<std::vector<float>>& rows) {
+    int total_columns = 0;
+    for (const auto& group : metadata["groups"]) {
+        total_columns += group["num_columns"].get<int>();
     }
 
-    input_file.close();
-    output_file.close();
+    for (int i = 0; i < num_rows; ++i) {
+        std::vector<float> row;
+        for (int j = 0; j < total_columns; ++j) {
+            std::string token;
+            float value = NAN;
+            if (!(std::cin >> token)) {
+                std::cerr << "Error: Failed to read row data" << std::endl;
+                return false;
+            }
+            if (token != "null") {
+                const char* first = token.data() + (token[0] == '+' ? 1 : 0);
+                const char* last = token.data() + token.size();
+                auto [ptr, error] = std::from_chars(first, last, value);
+                if (error != std::errc() || ptr != last || std::isnan(value)) {
+                    std::cerr << "Error: Invalid value: " << token << std::endl;
+                    return false;
+                }
+            }
+            row.push_back(value);
+        }
+        rows.push_back(row);
+    }
+    return true;
 }
 
 /**
@@ -560,14 +4439,19 @@ int main() {
         return 1;
     }
 
-    json metadata = extract_metadata(hty_file_path);
+    Snapshot snapshot;
+    json metadata = extract_metadata(hty_file_path, &snapshot);
     if (metadata.empty()) {
         return 1;
     }
 
     std::string first_input;
     if (!(std::cin >> first_input)) {
-        std::cout << "num_rows: " << metadata["num_rows"].get<int>() << std::endl;
+        long long num_rows = metadata["num_rows"].get<long long>();
+        if (metadata.contains("deletion_vector")) {
+            num_rows -= metadata["deletion_vector"]["num_deleted"].get<long long>();
+        }
+        std::cout << "num_rows: " << num_rows << std::endl;
         return 0;
     }
 
@@ -577,26 +4461,231 @@ int main() {
         std::cin >> modified_hty_file_path >> num_rows;
 
         std::vector<std::vector<float>> rows;
-        int total_columns = 0;
-        for (const auto& group : metadata["groups"]) {
-            total_columns += group["num_columns"].get<int>();
+        if (!read_rows(metadata, num_rows, rows)) {
+            return 1;
         }
 
-        for (int i = 0; i < num_rows; ++i) {
-            std::vector<float> row;
-            for (int j = 0; j < total_columns; ++j) {
-                float value;
-                if (!(std::cin >> value)) {
-                    std::cerr << "Error: Failed to read row data" << std::endl;
-                    return 1;
-                }
-                row.push_back(value);
+        add_row(metadata, snapshot, hty_file_path, modified_hty_file_path, rows);
+        return 0;
+    } else if (first_input == "append_row") {
+        int num_rows;
+        std::cin >> num_rows;
+
+        std::vector<std::vector<float>> rows;
+        if (!read_rows(metadata, num_rows, rows)) {
+            return 1;
+        }
+
+        if (!append_row(metadata, hty_file_path, rows)) {
+            return 1;
+        }
+        compact_in_background(hty_file_path);
+        return 0;
+    } else if (first_input == "bulk_append") {
+        // Source rows, their format, and an optional rewrite destination
+        std::string source_path, format, modified_hty_file_path;
+        if (!(std::cin >> source_path >> format)) {
+            std::cerr << "Error: Failed to read input file and format" << std::endl;
+            return 1;
+        }
+        std::cin >> modified_hty_file_path;
+
+        if (!bulk_append(metadata, snapshot, hty_file_path, source_path, format,
+                         modified_hty_file_path)) {
+            return 1;
+        }
+        if (modified_hty_file_path.empty()) {
+            compact_in_background(hty_file_path);
+        }
+        return 0;
+    } else if (first_input == "delete" || first_input == "update") {
+        // update <set_column> <set_value> <op> <value> <column>
+        // delete <op> <value> <column>
+        std::string set_column, filtered_column;
+        float set_value = 0.0f, value;
+        int op;
+        if (first_input == "update" && !(std::cin >> set_column >> set_value)) {
+            std::cerr << "Error: Failed to read assignment" << std::endl;
+            return 1;
+        }
+        if (!(std::cin >> op >> value >> filtered_column) || op < 0 || op > 5) {
+            std::cerr << "Error: Failed to read filter condition" << std::endl;
+            return 1;
+        }
+
+        long long affected = delete_or_update(hty_file_path, filtered_column, op, value,
+                                              set_column, set_value);
+        if (affected < 0) {
+            return 1;
+        }
+        std::cout << (set_column.empty() ? "deleted: " : "updated: ") << affected << std::endl;
+        compact_in_background(hty_file_path);
+        return 0;
+    } else if (first_input == "aggregate") {
+        // aggregate <sum|count|min|max> <column> [<op> <value> <filter_column>]
+        std::string function, column, filtered_column;
+        int op = 0;
+        float value = 0.0f;
+        if (!(std::cin >> function >> column) ||
+            (function != "sum" && function != "count" && function != "min" &&
+             function != "max")) {
+            std::cerr << "Error: Failed to read aggregate function and column" << std::endl;
+            return 1;
+        }
+        if (std::cin >> op && (!(std::cin >> value >> filtered_column) || op < 0 || op > 5)) {
+            std::cerr << "Error: Failed to read filter condition" << std::endl;
+            return 1;
+        }
+
+        Aggregate result;
+        if (!aggregate_column(metadata, snapshot, hty_file_path, column, filtered_column, op, value,
+                              function == "sum", result)) {
+            return 1;
+        }
+        std::cout << function << ": ";
+        if (function == "count") {
+            std::cout << result.count << std::endl;
+        } else if (result.count == 0) {
+            std::cout << "null" << std::endl;
+        } else {
+            double answer = function == "sum" ? result.sum
+                            : function == "min" ? result.min : result.max;
+            std::cout << format_large_number(answer) << std::endl;
+        }
+        return 0;
+    } else if (first_input == "build_index") {
+        std::string column;
+        if (!(std::cin >> column)) {
+            std::cerr << "Error: Failed to read column name" << std::endl;
+            return 1;
+        }
+        long long entries = build_index(hty_file_path, column);
+        if (entries < 0) {
+            return 1;
+        }
+        std::cout << "indexed: " << entries << std::endl;
+        return 0;
+    } else if (first_input == "build_bitmap_index") {
+        std::string column;
+        if (!(std::cin >> column)) {
+            std::cerr << "Error: Failed to read column name" << std::endl;
+            return 1;
+        }
+        long long values = build_bitmap_index(hty_file_path, column);
+        if (values < 0) {
+            return 1;
+        }
+        std::cout << "indexed values: " << values << std::endl;
+        return 0;
+    } else if (first_input == "count") {
+        // count [NOT] <column> <op> <value> [AND|OR [NOT] <column> <op> <value>]...
+        std::vector<Predicate> predicates;
+        std::string token;
+        bool combine_or = false, expecting = true;
+        while (std::cin >> token) {
+            Predicate predicate = {combine_or, token == "NOT", "", 0, 0.0f};
+            if (predicate.negate && !(std::cin >> token)) {
+                break;
+            }
+            predicate.column = token;
+            if (!(std::cin >> predicate.operation >> predicate.value) ||
+                predicate.operation < 0 || predicate.operation > 5) {
+                std::cerr << "Error: Failed to read filter condition" << std::endl;
+                return 1;
+            }
+            predicates.push_back(predicate);
+            expecting = false;
+            if (!(std::cin >> token)) {
+                break;
+            }
+            if (token != "AND" && token != "OR") {
+                std::cerr << "Error: Expected AND or OR, got " << token << std::endl;
+                return 1;
+            }
+            combine_or = token == "OR";
+            expecting = true;
+        }
+        if (expecting) {
+            std::cerr << "Error: Failed to read filter condition" << std::endl;
+            return 1;
+        }
+
+        long long count = count_matching(metadata, snapshot, hty_file_path, predicates);
+        if (count < 0) {
+            return 1;
+        }
+        std::cout << "count: " << count << std::endl;
+        return 0;
+    } else if (first_input == "fetch") {
+        // fetch <num_columns> <columns>... <num_rows> <row ids, ascending>...
+        int num_columns = 0, num_rows = 0;
+        std::vector<std::string> column_names;
+        std::vector<long long> row_ids;
+        if (!(std::cin >> num_columns) || num_columns <= 0) {
+            std::cerr << "Error: Invalid number of columns" << std::endl;
+            return 1;
+        }
+        column_names.resize(num_columns);
+        for (auto& column : column_names) {
+            if (!(std::cin >> column)) {
+                std::cerr << "Error: Failed to read column name" << std::endl;
+                return 1;
+            }
+        }
+        if (!(std::cin >> num_rows) || num_rows < 0) {
+            std::cerr << "Error: Invalid number of rows" << std::endl;
+            return 1;
+        }
+        row_ids.resize(num_rows);
+        for (auto& row : row_ids) {
+            if (!(std::cin >> row)) {
+                std::cerr << "Error: Failed to read row id" << std::endl;
+                return 1;
             }
-            rows.push_back(row);
         }
 
-        add_row(metadata, hty_file_path, modified_hty_file_path, rows);
+        auto result = fetch_rows(metadata, snapshot, hty_file_path, column_names, row_ids);
+        if (result.empty()) {
+            return 1;
+        }
+        display_result_set(metadata, column_names, result);
+        return 0;
+    } else if (first_input == "estimate") {
+        // estimate <column> <op> <value>
+        std::string column;
+        int op;
+        float value;
+        if (!(std::cin >> column >> op >> value) || op < 0 || op > 5) {
+            std::cerr << "Error: Failed to read filter condition" << std::endl;
+            return 1;
+        }
+        auto [group_index, column_index] = get_column_info(metadata, column);
+        if (group_index == -1) {
+            return 1;
+        }
+        long long estimate = estimate_matches(metadata, group_index, column_index, op, value);
+        if (estimate < 0) {
+            std::cerr << "Error: Column " << column << " has no statistics" << std::endl;
+            return 1;
+        }
+        std::cout << "estimated: " << estimate << std::endl;
+        return 0;
+    } else if (first_input == "calibrate") {
+        IoCost cost;
+        if (!calibrate_io_cost(hty_file_path, cost)) {
+            return 1;
+        }
+        std::cout << "seek_micros: " << cost.seek_micros << std::endl;
+        std::cout << "mb_per_second: " << cost.bytes_per_micro << std::endl;
         return 0;
+    } else if (first_input == "session") {
+        // One range filter per line: <column> <low> <high>
+        return run_cracking_session(metadata, snapshot, hty_file_path) ? 0 : 1;
+    } else if (first_input == "compact") {
+        // Optional destination; compact in place when omitted
+        std::string output_path;
+        std::cin >> output_path;
+        return compact(hty_file_path, output_path, false) ? 0 : 1;
     } else {
         try {
             int num_columns = std::stoi(first_input);
@@ -641,22 +4730,28 @@ int main() {
                 }
 
                 if (column_names.size() == 1 && column_names[0] == filter_column) {
-                    auto filtered_data = filter(metadata, hty_file_path, filter_column, 
-                                             operation, filter_value);
+                    std::vector<float> filtered_data;
+                    if (!filter(metadata, snapshot, hty_file_path, filter_column, operation,
+                                filter_value, filtered_data)) {
+                        return 1;
+                    }
                     display_column(metadata, filter_column, filtered_data);
                 } else {
-                    auto result_set = project_and_filter(metadata, hty_file_path, 
-                                                       column_names, filter_column, 
-                                                       operation, filter_value);
+                    std::vector<std::vector<float>> result_set;
+                    if (!project_and_filter(metadata, snapshot, hty_file_path, column_names,
+                                            filter_column, operation, filter_value,
+                                            result_set)) {
+                        return 1;
+                    }
                     display_result_set(metadata, column_names, result_set);
                 }
             } else {
                 if (column_names.size() == 1) {
-                    auto column_data = project_single_column(metadata, hty_file_path, 
+                    auto column_data = project_single_column(metadata, snapshot, hty_file_path, 
                                                           column_names[0]);
                     display_column(metadata, column_names[0], column_data);
                 } else {
-                    auto result_set = project(metadata, hty_file_path, column_names);
+                    auto result_set = project(metadata, snapshot, hty_file_path, column_names);
                     display_result_set(metadata, column_names, result_set);
                 }
             }
@@ -16,13 +16,43 @@
 #include <nlohmann/json.hpp>
 #include <cmath>
 #include <regex>
+#include <map>
+#include <set>
+#include <queue>
+#include <functional>
+#include <filesystem>
+#include "hty_encoding.hpp"
+#include "hty_stats.hpp"
 
 using json = nlohmann::json;
 
 // Constants for file processing
 #define DEFAULT_COLUMN_PREFIX "column_"
 #define DEFAULT_FLOAT_TYPE "float"
+#define DEFAULT_INT_TYPE "int"
 #define DEFAULT_FLOAT_VALUE 0.0f
+#define SORT_RUN_BYTES (64 << 20)   // Input bytes sorted in memory per run of the external sort
+
+/**
+ * @brief Layout options read after the file paths
+ *
+ * Without an encoding the converter writes the row-major layout described
+ * in the README. Naming one, for all columns or for a single column, or
+ * asking for compression or Bloom filters writes columnar blocks instead.
+ */
+struct ConvertOptions {
+    std::string encoding;             // Default column encoding, empty for row-major output
+    std::map<std::string, std::string> column_encodings;   // Per-column overrides
+    int block_rows = HTY_BLOCK_ROWS;  // Rows per columnar block
+    std::string compression;          // Chunk compression, empty for none
+    std::set<std::string> bloom_columns;   // Columns given per-block Bloom filters
+    std::vector<std::string> sort_columns;  // Key columns to sort rows by, empty to keep input order
+
+    bool columnar() const {
+        return !encoding.empty() || !column_encodings.empty() || !compression.empty() ||
+               !bloom_columns.empty();
+    }
+};
 
 /**
  * @brief Checks if a string represents a valid number
@@ -36,6 +66,26 @@ bool is_number(const std::string& str) {
     return std::regex_match(str, number_regex);
 }
 
+/**
+ * @brief Checks if a string is an integer small enough to be exact as a float
+ * @param[in] str String to check
+ * @return true if string is such an integer, false otherwise
+ */
+bool is_small_integer(const std::string& str) {
+    static const std::regex integer_regex("^[-+]?[0-9]{1,9}$");
+    return std::regex_match(str, integer_regex) && std::abs(std::stol(str)) <= INT_COLUMN_LIMIT;
+}
+
+/**
+ * @brief Checks if a string names a column encoding the writer supports
+ * @param[in] name Encoding name
+ * @return true for a supported encoding
+ */
+bool is_encoding(const std::string& name) {
+    return name == "raw" || name == "dict" || name == "for" || name == "xor" ||
+           name == "rle" || name == "auto";
+}
+
 /**
  * @brief Splits a CSV line into tokens
  * @param[in] line CSV line to split
@@ -66,43 +116,435 @@ std::vector<std::string> generate_column_names(size_t count) {
     return names;
 }
 
+/**
+ * @brief Parses a CSV field the way every column stores it
+ * @param[in] value Field text, empty if missing
+ * @return Numeric value, DEFAULT_FLOAT_VALUE if not a number
+ */
+float parse_value(const std::string& value) {
+    if (is_number(value)) {
+        return static_cast<float>(std::stod(value));
+    }
+    return DEFAULT_FLOAT_VALUE;
+}
+
+/**
+ * @brief Reads the sort key of a CSV line
+ * @param[in] line CSV line
+ * @param[in] key_columns Indices of the key columns, most significant first
+ * @return Key values, NaN for missing or non-numeric fields
+ */
+std::vector<float> sort_key(const std::string& line, const std::vector<size_t>& key_columns) {
+    std::vector<std::string> fields = split_csv_line(line);
+    std::vector<float> key;
+    for (size_t column : key_columns) {
+        bool present = column < fields.size() && is_number(fields[column]);
+        key.push_back(present ? parse_value(fields[column]) : NAN);
+    }
+    return key;
+}
+
+/**
+ * @brief Orders sort keys column by column, missing values last
+ * @param[in] a First key
+ * @param[in] b Second key
+ * @return true if a sorts before b
+ */
+bool key_less(const std::vector<float>& a, const std::vector<float>& b) {
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (std::isnan(a[i]) || std::isnan(b[i])) {
+            if (std::isnan(a[i]) != std::isnan(b[i])) {
+                return std::isnan(b[i]);
+            }
+        } else if (a[i] != b[i]) {
+            return a[i] < b[i];
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Sorted runs of CSV lines awaiting a merge
+ *
+ * Holds the only run in memory when all lines fit in one, and otherwise
+ * names the run files, which are removed with the object.
+ */
+struct SortRuns {
+    std::vector<std::string> lines;   // Sorted lines of the only run
+    std::vector<std::string> paths;   // Run files, each sorted, in input order
+
+    ~SortRuns() {
+        for (const auto& path : paths) {
+            std::filesystem::remove(path);
+        }
+    }
+};
+
+/**
+ * @brief Splits CSV lines into sorted runs for an external merge sort
+ *
+ * Lines are read in runs of about SORT_RUN_BYTES and each run is stably
+ * sorted in memory. A run is written to a temporary run file unless it is
+ * the only one.
+ *
+ * @param[in,out] input CSV stream positioned after the lines already read
+ * @param[in] first_line Data line already read from the stream, empty if none
+ * @param[in] key_columns Indices of the key columns, most significant first
+ * @param[in] run_prefix Path prefix for the run files
+ * @param[out] runs Sorted runs
+ * @return true on success, false otherwise
+ */
+bool write_sort_runs(std::istream& input, const std::string& first_line,
+                     const std::vector<size_t>& key_columns, const std::string& run_prefix,
+                     SortRuns& runs) {
+    std::vector<std::pair<std::vector<float>, std::string>> run;
+    size_t run_bytes = 0;
+    std::string line = first_line;
+    bool more = !first_line.empty() || static_cast<bool>(std::getline(input, line));
+
+    while (more) {
+        run_bytes += line.size() + key_columns.size() * sizeof(float);
+        run.emplace_back(sort_key(line, key_columns), std::move(line));
+        more = static_cast<bool>(std::getline(input, line));
+        if (more && run_bytes < SORT_RUN_BYTES) {
+            continue;
+        }
+
+        std::stable_sort(run.begin(), run.end(), [](const auto& a, const auto& b) {
+            return key_less(a.first, b.first);
+        });
+        if (!more && runs.paths.empty()) {
+            // Everything fit in one run
+            for (auto& entry : run) {
+                runs.lines.push_back(std::move(entry.second));
+            }
+            return true;
+        }
+
+        runs.paths.push_back(run_prefix + std::to_string(runs.paths.size()));
+        std::ofstream run_file(runs.paths.back());
+        for (const auto& entry : run) {
+            run_file << entry.second << '\n';
+        }
+        if (!run_file) {
+            std::cerr << "Error: Unable to write sort run " << runs.paths.back() << std::endl;
+            return false;
+        }
+        run.clear();
+        run_bytes = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief Merges sorted runs, passing each line on in key order
+ *
+ * Ties go to the earlier run, so equal keys keep their input order, and
+ * memory holds one line per run. The runs are left in place, so they can
+ * be merged again.
+ *
+ * @param[in] runs Sorted runs
+ * @param[in] key_columns Indices of the key columns, most significant first
+ * @param[in] emit Called with each line in sorted order
+ * @return true on success, false otherwise
+ */
+bool merge_sort_runs(const SortRuns& runs, const std::vector<size_t>& key_columns,
+                     const std::function<void(const std::string&)>& emit) {
+    for (const auto& line : runs.lines) {
+        emit(line);
+    }
+
+    // The smallest head line of all runs goes next
+    struct Head {
+        std::vector<float> key;
+        size_t run;
+        std::string line;
+    };
+    auto later = [](const Head& a, const Head& b) {
+        return key_less(b.key, a.key) || (!key_less(a.key, b.key) && a.run > b.run);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    std::vector<std::ifstream> files;
+    std::string line;
+    for (const auto& path : runs.paths) {
+        files.emplace_back(path);
+        if (!files.back().is_open()) {
+            std::cerr << "Error: Unable to read sort run " << path << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (std::getline(files[i], line)) {
+            heads.push({sort_key(line, key_columns), i, line});
+        }
+    }
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        emit(head.line);
+        if (std::getline(files[head.run], line)) {
+            heads.push({sort_key(line, key_columns), head.run, line});
+        }
+    }
+    return true;
+}
+
+// Passes every data row, split into fields, to the visitor; false on a read error
+using RowVisitor = std::function<void(const std::vector<std::string>&)>;
+using RowSource = std::function<bool(const RowVisitor&)>;
+
+/**
+ * @brief What one pass over the rows learns about a column
+ */
+struct ColumnProfile {
+    bool is_int = true;         // Every numeric field is a small integer
+    bool sorted = true;         // No field is missing, non-numeric or below the one before
+    float last = -INFINITY;     // Value of the previous row
+    StatisticsBuilder stats;
+};
+
+/**
+ * @brief Reads the rows once to infer types, sortedness and statistics
+ *
+ * Fields that are missing or not numbers are stored as 0 and do not
+ * decide the type. A column with such a field is never sorted, and
+ * neither is a column of a file without rows.
+ *
+ * @param[in] source Data rows
+ * @param[in] num_columns Number of columns
+ * @param[in] columnar Whether the output is columnar, where such fields are nulls
+ * @param[out] profiles One profile per column
+ * @param[out] num_rows Number of data rows
+ * @return true on success, false otherwise
+ */
+bool profile_rows(const RowSource& source, size_t num_columns, bool columnar,
+                  std::vector<ColumnProfile>& profiles, size_t& num_rows) {
+    profiles.assign(num_columns, ColumnProfile());
+    num_rows = 0;
+    bool read = source([&](const std::vector<std::string>& row) {
+        for (size_t i = 0; i < num_columns; ++i) {
+            ColumnProfile& profile = profiles[i];
+            const std::string field = i < row.size() ? row[i] : "";
+            bool numeric = is_number(field);
+            float value = parse_value(field);
+            if (profile.is_int && numeric && !is_small_integer(field)) {
+                profile.is_int = false;
+            }
+            if (profile.sorted) {
+                profile.sorted = numeric && value >= profile.last;
+                profile.last = value;
+            }
+
+            // Statistics see values as stored: nulls only exist in columnar output
+            profile.stats.add(columnar && !numeric ? NAN : value);
+        }
+        ++num_rows;
+    });
+    if (num_rows == 0) {
+        for (auto& profile : profiles) {
+            profile.sorted = false;
+        }
+    }
+    return read;
+}
+
+/**
+ * @brief Picks encodings for the "auto" columns from sampled windows of rows
+ * @param[in] source Data rows
+ * @param[in] num_rows Number of data rows
+ * @param[in] int_columns One flag per column, true for integer columns
+ * @param[in,out] encodings One encoding per column; "auto" is replaced
+ * @return true on success, false otherwise
+ */
+bool choose_auto_encodings(const RowSource& source, size_t num_rows,
+                           const std::vector<bool>& int_columns,
+                           std::vector<std::string>& encodings) {
+    std::vector<size_t> auto_columns;
+    for (size_t i = 0; i < encodings.size(); ++i) {
+        if (encodings[i] == "auto") {
+            auto_columns.push_back(i);
+        }
+    }
+    if (auto_columns.empty()) {
+        return true;
+    }
+
+    auto windows = sample_windows(num_rows);
+    std::vector<std::vector<std::vector<float>>> samples(encodings.size());
+    size_t row_index = 0;
+    size_t window = 0;
+    bool read = source([&](const std::vector<std::string>& fields) {
+        while (window < windows.size() && row_index >= windows[window].second) {
+            ++window;
+        }
+        if (window < windows.size() && row_index >= windows[window].first) {
+            for (size_t i : auto_columns) {
+                auto& column = samples[i];
+                if (row_index == windows[window].first) {
+                    column.emplace_back();
+                }
+                column.back().push_back(parse_value(i < fields.size() ? fields[i] : ""));
+            }
+        }
+        ++row_index;
+    });
+    if (!read) {
+        return false;
+    }
+
+    for (size_t i : auto_columns) {
+        encodings[i] = samples[i].empty() ? "raw" : choose_encoding(samples[i], int_columns[i]);
+    }
+    return true;
+}
+
 /**
  * @brief Creates metadata JSON object for HTY file
  * @param[in] header Column headers
- * @param[in] data_rows Data content
+ * @param[in] num_rows Number of data rows
+ * @param[in] profiles One profile per column
+ * @param[in] encodings One encoding per column, ignored for row-major output
+ * @param[in] options Layout options
  * @return JSON object containing metadata
  */
 json create_metadata(const std::vector<std::string>& header, 
-                    const std::vector<std::vector<std::string>>& data_rows) {
+                    size_t num_rows,
+                    const std::vector<ColumnProfile>& profiles,
+                    const std::vector<std::string>& encodings,
+                    const ConvertOptions& options) {
     json metadata;
-    metadata["num_rows"] = data_rows.size();
+    metadata["num_rows"] = num_rows;
     metadata["num_groups"] = 1;
+    metadata["file_id"] = new_file_id();
     
     json group;
     group["num_columns"] = header.size();
     group["offset"] = 0;
-    
+
     json columns;
-    for (const auto& col : header) {
+    for (size_t i = 0; i < header.size(); ++i) {
+        // Only columnar output types integer columns; row-major output stays all floats
+        bool is_int = options.columnar() && profiles[i].is_int;
+
         json column;
-        column["column_name"] = col;
-        column["column_type"] = DEFAULT_FLOAT_TYPE;
+        column["column_name"] = header[i];
+        column["column_type"] = is_int ? DEFAULT_INT_TYPE : DEFAULT_FLOAT_TYPE;
+        if (profiles[i].sorted) {
+            column["sorted"] = true;
+        }
+        if (options.columnar()) {
+            column["encoding"] = encodings[i];
+            if (options.bloom_columns.count(header[i])) {
+                column["bloom"] = true;
+            }
+        }
+        column["stats"] = profiles[i].stats.finish();
         columns.push_back(column);
     }
     
     group["columns"] = columns;
+    if (options.columnar()) {
+        group["block_rows"] = options.block_rows;
+        if (!options.compression.empty()) {
+            group["compression"] = options.compression;
+        }
+        group["segments"] = json::array();
+    }
     metadata["groups"].push_back(group);
     
     return metadata;
 }
 
+/**
+ * @brief Writes the rows as columnar blocks and records them in the metadata
+ *
+ * Holds one block of rows at a time.
+ *
+ * @param[in] source Data rows
+ * @param[in,out] metadata Metadata receiving one segment per block
+ * @param[in] options Layout options
+ * @param[out] hty_file Output file positioned at the start of the raw data
+ * @return true on success, false otherwise
+ */
+bool write_columnar_blocks(const RowSource& source,
+                           json& metadata,
+                           const ConvertOptions& options,
+                           std::ofstream& hty_file) {
+    json& group = metadata["groups"][0];
+    size_t num_columns = group["num_columns"];
+    long long offset = 0;
+    std::string bytes;
+    std::vector<std::vector<float>> values(num_columns);
+    int block_size = 0;
+
+    auto write_block = [&]() {
+        group["segments"].push_back(encode_block(group["columns"], values, offset, bytes,
+                                                 options.compression));
+        hty_file.write(bytes.data(), bytes.size());
+        offset += bytes.size();
+        for (auto& column : values) {
+            column.clear();
+        }
+        block_size = 0;
+    };
+
+    bool read = source([&](const std::vector<std::string>& row) {
+        for (size_t i = 0; i < num_columns; ++i) {
+            // Missing and non-numeric fields are nulls (NaN) in columnar output
+            const std::string field = i < row.size() ? row[i] : "";
+            values[i].push_back(is_number(field) ? parse_value(field) : NAN);
+        }
+        if (++block_size == options.block_rows) {
+            write_block();
+        }
+    });
+    if (read && block_size > 0) {
+        write_block();
+    }
+    return read;
+}
+
+/**
+ * @brief Writes the rows in the row-major layout and records their zone maps
+ * @param[in] source Data rows
+ * @param[in,out] metadata Metadata receiving the group's zone maps
+ * @param[out] hty_file Output file positioned at the start of the raw data
+ * @return true on success, false otherwise
+ */
+bool write_row_major(const RowSource& source, json& metadata, std::ofstream& hty_file) {
+    json& group = metadata["groups"][0];
+    size_t num_columns = group["num_columns"];
+    std::vector<ZoneMap> zones(num_columns);
+
+    bool read = source([&](const std::vector<std::string>& row) {
+        for (size_t i = 0; i < num_columns; ++i) {
+            float float_value = parse_value((i < row.size()) ? row[i] : "");
+            hty_file.write(reinterpret_cast<const char*>(&float_value), 
+                          sizeof(float));
+            zones[i].add(float_value);
+        }
+    });
+    for (const auto& zone : zones) {
+        group["zones"].push_back(zone.entry());
+    }
+    return read;
+}
+
 /**
  * @brief Converts CSV file to HTY format
+ *
+ * The rows are streamed through a profiling pass, a sampling pass when a
+ * column asks for the "auto" encoding, and the writing pass, re-reading
+ * the CSV or re-merging the sort runs each time. Memory holds at most
+ * one sort run, one line per run while merging, and one block of rows.
+ *
  * @param[in] csv_file_path Path to input CSV file
  * @param[in] hty_file_path Path to output HTY file
+ * @param[in] options Layout options
  */
 void convert_from_csv_to_hty(const std::string& csv_file_path, 
-                            const std::string& hty_file_path) {
+                            const std::string& hty_file_path,
+                            const ConvertOptions& options = ConvertOptions()) {
     std::ifstream csv_file(csv_file_path);
     std::ofstream hty_file(hty_file_path, std::ios::binary);
 
@@ -112,7 +554,8 @@ void convert_from_csv_to_hty(const std::string& csv_file_path,
     }
 
     std::string line;
-    std::vector<std::vector<std::string>> data;
+    std::string first_data_line;
+    bool first_line_is_data = false;
     std::vector<std::string> header;
 
     // Process first line
@@ -132,34 +575,92 @@ void convert_from_csv_to_hty(const std::string& csv_file_path,
             header = first_row;
         } else {
             header = generate_column_names(first_row.size());
-            data.push_back(first_row);
+            first_data_line = line;
+            first_line_is_data = true;
         }
     }
 
-    // Read remaining data
-    while (std::getline(csv_file, line)) {
-        data.push_back(split_csv_line(line));
+    for (const auto& [name, encoding] : options.column_encodings) {
+        if (std::find(header.begin(), header.end(), name) == header.end()) {
+            std::cerr << "Error: Unknown encoding column: " << name << std::endl;
+            return;
+        }
     }
 
-    // Create and write metadata
-    json metadata = create_metadata(header, data);
+    // Read the data rows, in key order when sorting
+    RowSource source;
+    SortRuns runs;
+    std::vector<size_t> key_columns;
+    if (!options.sort_columns.empty()) {
+        for (const auto& name : options.sort_columns) {
+            auto column = std::find(header.begin(), header.end(), name);
+            if (column == header.end()) {
+                std::cerr << "Error: Unknown sort column: " << name << std::endl;
+                return;
+            }
+            key_columns.push_back(column - header.begin());
+        }
+        if (!write_sort_runs(csv_file, first_data_line, key_columns, hty_file_path + ".run",
+                             runs)) {
+            return;
+        }
+        source = [&](const RowVisitor& visit) {
+            return merge_sort_runs(runs, key_columns, [&](const std::string& sorted_line) {
+                visit(split_csv_line(sorted_line));
+            });
+        };
+    } else {
+        source = [&](const RowVisitor& visit) {
+            std::ifstream input(csv_file_path);
+            std::string data_line;
+            if (!input.is_open()) {
+                std::cerr << "Error: Unable to open input or output file" << std::endl;
+                return false;
+            }
+            if (!first_line_is_data) {
+                std::getline(input, data_line);
+            }
+            while (std::getline(input, data_line)) {
+                visit(split_csv_line(data_line));
+            }
+            return true;
+        };
+    }
+
+    std::vector<ColumnProfile> profiles;
+    size_t num_rows = 0;
+    if (!profile_rows(source, header.size(), options.columnar(), profiles, num_rows)) {
+        return;
+    }
 
-    // Write data values
-    for (const auto& row : data) {
+    std::vector<std::string> encodings(header.size());
+    std::vector<bool> int_columns(header.size(), false);
+    if (options.columnar()) {
         for (size_t i = 0; i < header.size(); ++i) {
-            const auto& value = (i < row.size()) ? row[i] : "";
-            float float_value = DEFAULT_FLOAT_VALUE;
-            
-            if (is_number(value)) {
-                double double_value = std::stod(value);
-                float_value = static_cast<float>(double_value);
+            auto override = options.column_encodings.find(header[i]);
+            encodings[i] = override != options.column_encodings.end()
+                           ? override->second
+                           : options.encoding.empty() ? "raw" : options.encoding;
+            int_columns[i] = profiles[i].is_int;
+
+            // Frame of reference only applies to integers
+            if (encodings[i] == "for" && !int_columns[i]) {
+                encodings[i] = "raw";
             }
-            
-            hty_file.write(reinterpret_cast<const char*>(&float_value), 
-                          sizeof(float));
+        }
+        if (!choose_auto_encodings(source, num_rows, int_columns, encodings)) {
+            return;
         }
     }
 
+    // Create metadata, then write data values
+    json metadata = create_metadata(header, num_rows, profiles, encodings, options);
+    bool written = options.columnar() ? write_columnar_blocks(source, metadata, options, hty_file)
+                                      : write_row_major(source, metadata, hty_file);
+    if (!written) {
+        return;
+    }
+
     // Write metadata and its size
     std::string metadata_str = metadata.dump();
     hty_file.write(metadata_str.c_str(), metadata_str.size());
@@ -176,6 +677,35 @@ int main() {
     std::string csv_file_path, hty_file_path;
     std::cin >> csv_file_path >> hty_file_path;
 
-    convert_from_csv_to_hty(csv_file_path, hty_file_path);
+    // Optional key=value options follow the paths
+    ConvertOptions options;
+    std::string option;
+    while (std::cin >> option) {
+        size_t equals = option.find('=');
+        std::string key = option.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+        if (key == "encoding" && is_encoding(value)) {
+            options.encoding = value;
+        } else if (key.rfind("encoding.", 0) == 0 && key.size() > 9 && is_encoding(value)) {
+            options.column_encodings[key.substr(9)] = value;
+        } else if (key == "bloom" && !value.empty()) {
+            options.bloom_columns.insert(value);
+        } else if (key == "sort" && !value.empty()) {
+            std::istringstream names(value);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                options.sort_columns.push_back(name);
+            }
+        } else if (key == "compression" && value == "lz") {
+            options.compression = value;
+        } else if (key == "block_rows" && is_number(value) && std::stoi(value) > 0) {
+            options.block_rows = std::stoi(value);
+        } else {
+            std::cerr << "Error: Invalid option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+    convert_from_csv_to_hty(csv_file_path, hty_file_path, options);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1722 @@
+/**
+ * @brief Column chunk encodings shared by the HTY converter and analyzer
+ *
+ * Columnar segments store each column of a block of rows as a separate
+ * chunk. A chunk is a payload of bytes plus a small JSON object in the
+ * footer naming its encoding and the parameters needed to decode it. This
+ * header holds the encoders used by writers, the decoders used by readers,
+ * and filter kernels that evaluate predicates on encoded chunks directly.
+ *
+ * Values travel through the API as floats. Columns typed "int" are stored
+ * as 32-bit signed integers and converted on the way in and out.
+ */
+
+#ifndef HTY_ENCODING_HPP
+#define HTY_ENCODING_HPP
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+#include <random>
+#include <nlohmann/json.hpp>
+#include "hty_lz.hpp"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Rows per block of a columnar segment unless the writer is told otherwise
+#define HTY_BLOCK_ROWS 65536
+
+// Largest dictionary a chunk may use; codes are 8 or 16 bits wide
+#define DICT_MAX_ENTRIES 65536
+
+// Bit-packed values are interleaved over this many 32-bit lanes, so one
+// vector load fetches the same word of every lane
+#define PACK_LANES 8
+#define PACK_GROUP (PACK_LANES * 32)   // Values per packed group
+
+// Integers beyond this magnitude are not exact as floats and stay "float"
+#define INT_COLUMN_LIMIT (1 << 24)
+
+// Encoding selection encodes this many windows of contiguous rows per column
+#define SAMPLE_WINDOWS 8
+#define SAMPLE_ROWS 4096
+
+// Split-block Bloom filters: 256-bit blocks of 8 words, one bit set per word
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_VALUE 10
+#define BLOOM_MAX_PROBES 16     // Most values one EQUAL filter may have to look up
+
+// Stored int pattern of a null in row-major slots, outside any int column's range
+#define NULL_INT_SLOT INT32_MIN
+
+/**
+ * @brief Filter operations enumeration
+ */
+enum FilterOperation {
+    GREATER_THAN,     // >
+    GREATER_EQUAL,    // >=
+    LESS_THAN,       // <
+    LESS_EQUAL,      // <=
+    EQUAL,           // =
+    NOT_EQUAL        // !=
+};
+
+/**
+ * @brief Applies filter operation to a value
+ * @param[in] value Value to compare
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @return true if value passes filter, false otherwise
+ */
+inline bool apply_filter(float value, int operation, float filter_value) {
+    const float EPSILON = 1e-6f;
+    switch (operation) {
+        case GREATER_THAN:
+            return value > filter_value;
+        case GREATER_EQUAL:
+            return value >= filter_value;
+        case LESS_THAN:
+            return value < filter_value;
+        case LESS_EQUAL:
+            return value <= filter_value;
+        case EQUAL:
+            return std::abs(value - filter_value) < EPSILON;
+        case NOT_EQUAL:
+            return std::abs(value - filter_value) >= EPSILON;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Draws a random id for a newly written HTY file
+ *
+ * Sidecar indexes record the id of the file they were built on, so an
+ * index left behind by an older file at the same path is never trusted,
+ * even though both files start at generation 0.
+ *
+ * @return Non-zero 64-bit id
+ */
+inline uint64_t new_file_id() {
+    std::random_device device;
+    uint64_t id = 0;
+    while (id == 0) {
+        id = (static_cast<uint64_t>(device()) << 32) | device();
+    }
+    return id;
+}
+
+/**
+ * @brief Checks whether a column is stored as 32-bit integers
+ * @param[in] column Column entry of the metadata
+ * @return true for "int" columns
+ */
+inline bool is_int_column(const nlohmann::json& column) {
+    return column["column_type"] == "int";
+}
+
+/**
+ * @brief Checks whether an "int" column stores a value unchanged
+ *
+ * Integers below 2^31 in magnitude convert to an int32 exactly and never
+ * to NULL_INT_SLOT. Anything else would be rounded or clamped.
+ *
+ * @param[in] value Value as seen through the API
+ * @return true for a null or such an integer
+ */
+inline bool fits_int_column(float value) {
+    return std::isnan(value) || (value == std::trunc(value) && std::abs(value) < 2147483648.0f);
+}
+
+/**
+ * @brief Converts a value to its stored 32-bit pattern
+ *
+ * Row-major slices keep values as stored on disk, so an "int" value is
+ * carried in a float slot holding the bits of an int32. A null (NaN) int
+ * is stored as NULL_INT_SLOT.
+ *
+ * @param[in] value Value as seen through the API
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Float slot holding the stored bits
+ */
+inline float store_value(float value, bool is_int) {
+    if (!is_int) {
+        return value;
+    }
+    int32_t integer = std::isnan(value) ? NULL_INT_SLOT : static_cast<int32_t>(
+        std::clamp(std::round(value), -2147483647.0f, 2147483520.0f));
+    float slot;
+    std::memcpy(&slot, &integer, sizeof(slot));
+    return slot;
+}
+
+/**
+ * @brief Gives the stored 32-bit pattern of a value as an integer
+ *
+ * Stored int slots are often NaN patterns as floats, and a null int slot
+ * reads as -0.0f, so stored values are compared through their bits.
+ *
+ * @param[in] value Value as seen through the API
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Bits of the stored value
+ */
+inline uint32_t stored_bits(float value, bool is_int) {
+    float slot = store_value(value, is_int);
+    uint32_t bits;
+    std::memcpy(&bits, &slot, sizeof(bits));
+    return bits;
+}
+
+/**
+ * @brief Converts a stored 32-bit pattern back to a value
+ * @param[in] slot Float slot holding the stored bits
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Value as seen through the API
+ */
+inline float load_value(float slot, bool is_int) {
+    if (!is_int) {
+        return slot;
+    }
+    int32_t integer;
+    std::memcpy(&integer, &slot, sizeof(integer));
+    return integer == NULL_INT_SLOT ? NAN : static_cast<float>(integer);
+}
+
+/**
+ * @brief Chunk payload together with the footer fields that describe it
+ */
+struct EncodedChunk {
+    std::string bytes;          // Payload written to the file
+    nlohmann::json info;        // "encoding" plus encoding-specific fields
+};
+
+/**
+ * @brief Stores values as plain 32-bit patterns of the column type
+ * @param[in] values Values of the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Raw chunk
+ */
+inline EncodedChunk encode_raw(const std::vector<float>& values, bool is_int) {
+    EncodedChunk chunk;
+    chunk.bytes.resize(values.size() * sizeof(float));
+    for (size_t i = 0; i < values.size(); ++i) {
+        float slot = store_value(values[i], is_int);
+        std::memcpy(&chunk.bytes[i * sizeof(float)], &slot, sizeof(float));
+    }
+    chunk.info = {{"encoding", "raw"}};
+    return chunk;
+}
+
+/**
+ * @brief Dictionary-encodes values with 8- or 16-bit codes
+ *
+ * The payload is the sorted dictionary of distinct values, stored as the
+ * column type, followed by one code per row. Because the dictionary is
+ * sorted, codes preserve the order of the values, which lets range
+ * predicates run on the codes.
+ *
+ * @param[in] values Values of the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[out] chunk Encoded chunk
+ * @return false if there are too many distinct values to pay off
+ */
+inline bool encode_dictionary(const std::vector<float>& values, bool is_int,
+                              EncodedChunk& chunk) {
+    std::vector<float> dictionary(values);
+    std::sort(dictionary.begin(), dictionary.end());
+    dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+    size_t code_bytes = dictionary.size() <= 256 ? 1 : 2;
+    size_t encoded_size = dictionary.size() * sizeof(float) + values.size() * code_bytes;
+    if (dictionary.size() > DICT_MAX_ENTRIES ||
+        encoded_size >= values.size() * sizeof(float)) {
+        return false;
+    }
+
+    chunk.bytes.resize(encoded_size);
+    char* out = chunk.bytes.data();
+    for (float entry : dictionary) {
+        float slot = store_value(entry, is_int);
+        std::memcpy(out, &slot, sizeof(float));
+        out += sizeof(float);
+    }
+    for (float value : values) {
+        uint16_t code = std::lower_bound(dictionary.begin(), dictionary.end(), value) -
+                        dictionary.begin();
+        std::memcpy(out, &code, code_bytes);
+        out += code_bytes;
+    }
+
+    chunk.info = {{"encoding", "dict"},
+                  {"dict_size", dictionary.size()},
+                  {"code_bits", code_bytes * 8}};
+    return true;
+}
+
+/**
+ * @brief Bit-packs integers as offsets from their minimum (frame of reference)
+ *
+ * Offsets take bit_width bits each. Every group of PACK_GROUP values is
+ * spread over PACK_LANES interleaved lanes: value t * PACK_LANES + lane
+ * sits at bit t * bit_width of its lane, and word k of a lane is stored
+ * at k * PACK_LANES + lane. A decoder can then shift and mask all lanes
+ * at once. The last group is padded with zero offsets.
+ *
+ * @param[in] values Integers to pack
+ * @param[out] chunk Chunk receiving the packed words, "reference" and "bit_width"
+ */
+inline void pack_integers(const std::vector<int32_t>& values, EncodedChunk& chunk) {
+    int32_t reference = values.empty() ? 0 : *std::min_element(values.begin(), values.end());
+    uint32_t range = 0;
+    for (int32_t value : values) {
+        range = std::max(range, static_cast<uint32_t>(value) - static_cast<uint32_t>(reference));
+    }
+    int bit_width = range == 0 ? 0 : 32 - __builtin_clz(range);
+
+    size_t num_groups = (values.size() + PACK_GROUP - 1) / PACK_GROUP;
+    std::vector<uint32_t> words(num_groups * PACK_LANES * bit_width, 0);
+    for (size_t i = 0; i < values.size() && bit_width > 0; ++i) {
+        uint32_t offset = static_cast<uint32_t>(values[i]) - static_cast<uint32_t>(reference);
+        size_t group = i / PACK_GROUP;
+        size_t t = i % PACK_GROUP / PACK_LANES;
+        size_t lane = i % PACK_LANES;
+        uint32_t* lane_words = &words[group * PACK_LANES * bit_width + lane];
+
+        size_t bit = t * bit_width;
+        size_t shift = bit % 32;
+        lane_words[bit / 32 * PACK_LANES] |= offset << shift;
+        if (shift + bit_width > 32) {
+            lane_words[(bit / 32 + 1) * PACK_LANES] |= offset >> (32 - shift);
+        }
+    }
+
+    chunk.bytes.append(reinterpret_cast<const char*>(words.data()),
+                       words.size() * sizeof(uint32_t));
+    chunk.info["reference"] = reference;
+    chunk.info["bit_width"] = bit_width;
+}
+
+/**
+ * @brief Unpacks bit-packed groups, adding the reference back
+ *
+ * Each step extracts the same value slot of all lanes with one shift,
+ * an optional second shift for offsets spilling into the next word, one
+ * mask and one add. Float output is converted in the same registers.
+ *
+ * @param[in] words Packed lane words
+ * @param[in] bit_width Bits per offset
+ * @param[in] reference Minimum added back to every offset
+ * @param[in] num_groups Number of packed groups
+ * @param[out] out Room for num_groups * PACK_GROUP values, int32_t or float
+ */
+template <typename T>
+inline void unpack_integers(const uint32_t* words, int bit_width, int32_t reference,
+                            size_t num_groups, T* out) {
+    constexpr bool to_float = std::is_same_v<T, float>;
+    if (bit_width == 0) {
+        std::fill(out, out + num_groups * PACK_GROUP, static_cast<T>(reference));
+        return;
+    }
+    uint32_t mask = bit_width == 32 ? ~0u : (1u << bit_width) - 1;
+
+    for (size_t group = 0; group < num_groups; ++group) {
+        const uint32_t* in = words + group * PACK_LANES * bit_width;
+        T* dst = out + group * PACK_GROUP;
+        for (int t = 0; t < 32; ++t) {
+            int bit = t * bit_width;
+            int shift = bit % 32;
+            bool spill = shift + bit_width > 32;
+            const uint32_t* word = in + bit / 32 * PACK_LANES;
+#if defined(__AVX2__)
+            __m256i lanes = _mm256_srl_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(word)),
+                _mm_cvtsi32_si128(shift));
+            if (spill) {
+                lanes = _mm256_or_si256(lanes, _mm256_sll_epi32(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(word + PACK_LANES)),
+                    _mm_cvtsi32_si128(32 - shift)));
+            }
+            lanes = _mm256_add_epi32(_mm256_and_si256(lanes, _mm256_set1_epi32(mask)),
+                                     _mm256_set1_epi32(reference));
+            if constexpr (to_float) {
+                _mm256_storeu_ps(dst + t * PACK_LANES, _mm256_cvtepi32_ps(lanes));
+            } else {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + t * PACK_LANES), lanes);
+            }
+#elif defined(__SSE2__)
+            for (int half = 0; half < PACK_LANES; half += 4) {
+                __m128i lanes = _mm_srl_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(word + half)),
+                    _mm_cvtsi32_si128(shift));
+                if (spill) {
+                    lanes = _mm_or_si128(lanes, _mm_sll_epi32(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                            word + PACK_LANES + half)),
+                        _mm_cvtsi32_si128(32 - shift)));
+                }
+                lanes = _mm_add_epi32(_mm_and_si128(lanes, _mm_set1_epi32(mask)),
+                                      _mm_set1_epi32(reference));
+                if constexpr (to_float) {
+                    _mm_storeu_ps(dst + t * PACK_LANES + half, _mm_cvtepi32_ps(lanes));
+                } else {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + t * PACK_LANES + half),
+                                     lanes);
+                }
+            }
+#else
+            for (int lane = 0; lane < PACK_LANES; ++lane) {
+                uint32_t offset = word[lane] >> shift;
+                if (spill) {
+                    offset |= word[PACK_LANES + lane] << (32 - shift);
+                }
+                dst[t * PACK_LANES + lane] =
+                    static_cast<T>(static_cast<int32_t>((offset & mask) + reference));
+            }
+#endif
+        }
+    }
+}
+
+/**
+ * @brief Replaces integers by their running sum, starting from a carry
+ *
+ * The vector path adds each value to its shifted copies within a
+ * register and then adds the last sum of the previous register.
+ *
+ * @param[in,out] values Integers to sum in place
+ * @param[in] count Number of integers
+ * @param[in] carry Value added before the first integer
+ */
+inline void prefix_sum(int32_t* values, size_t count, int32_t carry) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i running = _mm_set1_epi32(carry);
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, running);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), x);
+        running = _mm_shuffle_epi32(x, 0xFF);
+    }
+    carry = i > 0 ? values[i - 1] : carry;
+#endif
+    for (; i < count; ++i) {
+        carry += values[i];
+        values[i] = carry;
+    }
+}
+
+/**
+ * @brief Checks whether integers never decrease or never increase
+ * @param[in] values Integers to check
+ * @return true for a monotonic sequence
+ */
+inline bool is_monotonic(const std::vector<int32_t>& values) {
+    return std::is_sorted(values.begin(), values.end()) ||
+           std::is_sorted(values.rbegin(), values.rend());
+}
+
+/**
+ * @brief Bit-packs an integer chunk, choosing the smallest packed form
+ *
+ * Every chunk can be packed as offsets from its minimum ("for"). A
+ * monotonic chunk is also tried as its first value plus packed
+ * differences ("delta"), and as its first value and first difference
+ * plus packed differences of differences ("delta2"), which suits evenly
+ * spaced ids and timestamps.
+ *
+ * @param[in] values Values of the chunk, all integral
+ * @param[out] chunk Encoded chunk
+ * @return false if packing would not make the chunk smaller
+ */
+inline bool encode_packed(const std::vector<float>& values, EncodedChunk& chunk) {
+    if (values.empty()) {
+        return false;
+    }
+    std::vector<int32_t> integers(values.begin(), values.end());
+
+    EncodedChunk best;
+    best.info = {{"encoding", "for"}};
+    pack_integers(integers, best);
+
+    if (integers.size() >= 3 && is_monotonic(integers)) {
+        std::vector<int32_t> deltas(integers.size());
+        std::adjacent_difference(integers.begin(), integers.end(), deltas.begin());
+        EncodedChunk delta;
+        delta.info = {{"encoding", "delta"}, {"first", integers[0]}};
+        pack_integers(std::vector<int32_t>(deltas.begin() + 1, deltas.end()), delta);
+
+        std::vector<int32_t> second(deltas.size() - 1);
+        std::adjacent_difference(deltas.begin() + 1, deltas.end(), second.begin());
+        EncodedChunk delta2;
+        delta2.info = {{"encoding", "delta2"}, {"first", integers[0]},
+                       {"first_delta", deltas[1]}};
+        pack_integers(std::vector<int32_t>(second.begin() + 1, second.end()), delta2);
+
+        for (auto* candidate : {&delta, &delta2}) {
+            if (candidate->bytes.size() < best.bytes.size()) {
+                best = std::move(*candidate);
+            }
+        }
+    }
+
+    if (best.bytes.size() >= values.size() * sizeof(float)) {
+        return false;
+    }
+    chunk = std::move(best);
+    return true;
+}
+
+/**
+ * @brief Appends bit fields, most significant bit first, to a byte string
+ */
+struct BitWriter {
+    std::string& out;
+    uint64_t pending = 0;   // Bits not yet written out, in the low bits
+    int num_pending = 0;
+
+    /**
+     * @brief Appends the low count bits of a value
+     * @param[in] bits Value holding the bits
+     * @param[in] count Number of bits, at most 32
+     */
+    void write(uint32_t bits, int count) {
+        if (count == 0) {
+            return;
+        }
+        pending = pending << count | (bits & (count == 32 ? ~0u : (1u << count) - 1));
+        num_pending += count;
+        while (num_pending >= 8) {
+            num_pending -= 8;
+            out.push_back(static_cast<char>(pending >> num_pending));
+        }
+        pending &= (1ULL << num_pending) - 1;
+    }
+
+    /**
+     * @brief Pads the last partial byte with zeros and writes it
+     */
+    void flush() {
+        if (num_pending > 0) {
+            out.push_back(static_cast<char>(pending << (8 - num_pending)));
+            num_pending = 0;
+            pending = 0;
+        }
+    }
+};
+
+/**
+ * @brief Reads bit fields written by BitWriter, one after another
+ */
+struct BitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t position = 0;    // Bit position of the next field
+
+    /**
+     * @brief Reads the next field
+     * @param[in] count Number of bits, at most 32
+     * @return Field value
+     */
+    uint32_t read(int count) {
+        if (count == 0) {
+            return 0;
+        }
+        size_t byte = position / 8;
+        uint64_t window = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            window = window << 8 | (byte + i < size ? data[byte + i] : 0);
+        }
+        uint32_t bits = static_cast<uint32_t>((window << (position % 8)) >> (64 - count));
+        position += count;
+        return bits;
+    }
+};
+
+/**
+ * @brief Compresses values by XOR with the previous value (Gorilla style)
+ *
+ * The first value is stored as its 32 stored bits. After that a value
+ * equal to its predecessor costs one 0 bit. Otherwise a 1 bit is followed
+ * either by 0 and the XOR bits inside the previous window of meaningful
+ * bits, or by 1, a 5-bit count of leading zeros, a 5-bit count of
+ * meaningful bits minus one, and those bits. Slowly changing metrics
+ * share most of their sign, exponent and high mantissa bits with the
+ * previous row.
+ *
+ * @param[in] values Values of the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[out] chunk Encoded chunk
+ * @return false if the stream would not be smaller than raw values
+ */
+inline bool encode_xor(const std::vector<float>& values, bool is_int, EncodedChunk& chunk) {
+    if (values.empty()) {
+        return false;
+    }
+    chunk.bytes.clear();
+    BitWriter writer{chunk.bytes};
+
+    uint32_t previous = 0;
+    int window_leading = -1, window_trailing = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        float slot = store_value(values[i], is_int);
+        uint32_t bits;
+        std::memcpy(&bits, &slot, sizeof(bits));
+        if (i == 0) {
+            writer.write(bits, 32);
+            previous = bits;
+            continue;
+        }
+
+        uint32_t delta = bits ^ previous;
+        previous = bits;
+        if (delta == 0) {
+            writer.write(0, 1);
+            continue;
+        }
+        int leading = __builtin_clz(delta);
+        int trailing = __builtin_ctz(delta);
+        if (window_leading >= 0 && leading >= window_leading && trailing >= window_trailing) {
+            writer.write(0b10, 2);
+            writer.write(delta >> window_trailing, 32 - window_leading - window_trailing);
+        } else {
+            int meaningful = 32 - leading - trailing;
+            writer.write(0b11, 2);
+            writer.write(leading, 5);
+            writer.write(meaningful - 1, 5);
+            writer.write(delta >> trailing, meaningful);
+            window_leading = leading;
+            window_trailing = trailing;
+        }
+        if (chunk.bytes.size() >= values.size() * sizeof(float)) {
+            return false;
+        }
+    }
+    writer.flush();
+    chunk.info = {{"encoding", "xor"}};
+    return chunk.bytes.size() < values.size() * sizeof(float);
+}
+
+/**
+ * @brief Decodes an XOR stream value by value
+ * @param[in] bytes Chunk payload
+ * @param[in] num_rows Number of rows in the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[out] out Room for num_rows values
+ */
+inline void decode_xor(const std::string& bytes, int num_rows, bool is_int, float* out) {
+    BitReader reader{reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size()};
+    uint32_t bits = 0;
+    int window_leading = 0, window_trailing = 0;
+    for (int row = 0; row < num_rows; ++row) {
+        if (row == 0) {
+            bits = reader.read(32);
+        } else if (reader.read(1) == 1) {
+            if (reader.read(1) == 1) {
+                window_leading = reader.read(5);
+                window_trailing = 32 - window_leading - (reader.read(5) + 1);
+            }
+            bits ^= reader.read(32 - window_leading - window_trailing) << window_trailing;
+        }
+        float slot;
+        std::memcpy(&slot, &bits, sizeof(slot));
+        out[row] = load_value(slot, is_int);
+    }
+}
+
+/**
+ * @brief Run-length encodes values
+ *
+ * The payload is the value of every run, stored as the column type,
+ * followed by the run lengths bit-packed as in encode_packed's "for"
+ * form. Sorted or clustered columns collapse to a few runs per block.
+ * Runs compare stored bits, so negative ints merge and a null int never
+ * joins a run of zeros.
+ *
+ * @param[in] values Values of the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[out] chunk Encoded chunk
+ * @return false if the runs would not be smaller than raw values
+ */
+inline bool encode_rle(const std::vector<float>& values, bool is_int, EncodedChunk& chunk) {
+    std::vector<float> run_values;
+    std::vector<int32_t> run_lengths;
+    uint32_t run_bits = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        uint32_t bits = stored_bits(values[i], is_int);
+        if (i > 0 && bits == run_bits) {
+            ++run_lengths.back();
+        } else {
+            run_values.push_back(values[i]);
+            run_lengths.push_back(1);
+            run_bits = bits;
+        }
+    }
+    if (run_values.size() * sizeof(float) * 2 >= values.size() * sizeof(float)) {
+        return false;
+    }
+
+    chunk.bytes.clear();
+    for (float value : run_values) {
+        float slot = store_value(value, is_int);
+        chunk.bytes.append(reinterpret_cast<const char*>(&slot), sizeof(slot));
+    }
+    chunk.info = {{"encoding", "rle"}, {"num_runs", run_values.size()}};
+    pack_integers(run_lengths, chunk);
+    return chunk.bytes.size() < values.size() * sizeof(float);
+}
+
+/**
+ * @brief Reads the runs of a run-length encoded chunk
+ * @param[in] info Footer fields of the chunk
+ * @param[in] bytes Chunk payload
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[out] run_values Value of every run
+ * @param[out] run_lengths Length of every run
+ */
+inline void read_runs(const nlohmann::json& info, const std::string& bytes, bool is_int,
+                      std::vector<float>& run_values, std::vector<int32_t>& run_lengths) {
+    size_t num_runs = info["num_runs"].get<size_t>();
+    run_values.resize(num_runs);
+    std::memcpy(run_values.data(), bytes.data(), num_runs * sizeof(float));
+    for (float& value : run_values) {
+        value = load_value(value, is_int);
+    }
+
+    size_t num_groups = (num_runs + PACK_GROUP - 1) / PACK_GROUP;
+    std::vector<uint32_t> words((bytes.size() - num_runs * sizeof(float)) / sizeof(uint32_t));
+    std::memcpy(words.data(), bytes.data() + num_runs * sizeof(float),
+                words.size() * sizeof(uint32_t));
+    run_lengths.resize(num_groups * PACK_GROUP);
+    unpack_integers(words.data(), info["bit_width"].get<int>(),
+                    info["reference"].get<int32_t>(), num_groups, run_lengths.data());
+    run_lengths.resize(num_runs);
+}
+
+/**
+ * @brief Encodes a chunk with the requested encoding, falling back to raw
+ * @param[in] values Values of the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[in] encoding Requested encoding name
+ * @return Encoded chunk
+ */
+inline EncodedChunk encode_chunk(const std::vector<float>& values, bool is_int,
+                                 const std::string& encoding) {
+    EncodedChunk chunk;
+    if (encoding == "dict" && encode_dictionary(values, is_int, chunk)) {
+        return chunk;
+    }
+    if (encoding == "for" && is_int && encode_packed(values, chunk)) {
+        return chunk;
+    }
+    if (encoding == "xor" && encode_xor(values, is_int, chunk)) {
+        return chunk;
+    }
+    if (encoding == "rle" && encode_rle(values, is_int, chunk)) {
+        return chunk;
+    }
+    return encode_raw(values, is_int);
+}
+
+/**
+ * @brief Decode cost of an encoding, in bytes of I/O it is worth per value
+ * @param[in] encoding Encoding name as recorded in a chunk
+ * @return Cost added per value when comparing encodings
+ */
+inline double decode_cost(const std::string& encoding) {
+    if (encoding == "rle") {
+        return 0.05;
+    }
+    if (encoding == "for" || encoding == "delta" || encoding == "delta2") {
+        return 0.25;
+    }
+    if (encoding == "dict") {
+        return 0.5;
+    }
+    if (encoding == "xor") {
+        return 1.5;
+    }
+    return 0.0;
+}
+
+/**
+ * @brief Lists the row ranges sampled to choose a column's encoding
+ *
+ * Windows of contiguous rows, rather than scattered rows, keep the runs
+ * and monotonic stretches that some encodings depend on.
+ *
+ * @param[in] num_rows Number of rows in the column
+ * @return Up to SAMPLE_WINDOWS evenly spread [first, last) ranges
+ */
+inline std::vector<std::pair<size_t, size_t>> sample_windows(size_t num_rows) {
+    std::vector<std::pair<size_t, size_t>> windows;
+    size_t window_rows = std::min<size_t>(num_rows, SAMPLE_ROWS);
+    size_t num_windows = std::min<size_t>(SAMPLE_WINDOWS,
+                                          (num_rows + SAMPLE_ROWS - 1) / SAMPLE_ROWS);
+    for (size_t i = 0; i < num_windows; ++i) {
+        size_t first = (num_rows - window_rows) * i / std::max<size_t>(1, num_windows - 1);
+        windows.emplace_back(first, first + window_rows);
+    }
+    return windows;
+}
+
+/**
+ * @brief Picks a column's encoding from sampled windows of its values
+ *
+ * Encodes every window with every candidate and scores each candidate as
+ * bytes written plus decode_cost per value. Raw wins ties, so an encoding
+ * must save more than it costs to decode.
+ *
+ * @param[in] windows Sampled windows of contiguous values
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Encoding to record in the column metadata
+ */
+inline std::string choose_encoding(const std::vector<std::vector<float>>& windows,
+                                   bool is_int) {
+    std::string best = "raw";
+    double best_score = INFINITY;
+    for (const char* candidate : {"raw", "rle", "for", "dict", "xor"}) {
+        if (std::string(candidate) == "for" && !is_int) {
+            continue;
+        }
+        double score = 0.0;
+        for (const auto& window : windows) {
+            EncodedChunk chunk = encode_chunk(window, is_int, candidate);
+            score += chunk.bytes.size() + window.size() * decode_cost(chunk.info["encoding"]);
+        }
+        if (score < best_score) {
+            best = candidate;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Hashes a value for the Bloom filters
+ * @param[in] value Value as seen through the API
+ * @return 64-bit hash; 0 and -0 hash alike
+ */
+inline uint64_t bloom_hash(float value) {
+    if (value == 0.0f) {
+        value = 0.0f;
+    }
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint64_t hash = bits + 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * @brief Finds the Bloom filter block a hash falls in
+ * @param[in] hash Value hash
+ * @param[in] num_blocks Number of blocks in the filter
+ * @return Block index
+ */
+inline size_t bloom_block(uint64_t hash, size_t num_blocks) {
+    return static_cast<size_t>(((hash >> 32) * num_blocks) >> 32);
+}
+
+/**
+ * @brief Computes the bit a hash sets in each word of its block
+ *
+ * Each word multiplies the low half of the hash by its own odd salt and
+ * takes the top 5 bits as the bit index, 8 multiplies done as one AVX2
+ * instruction when available.
+ *
+ * @param[in] hash Value hash
+ * @param[out] mask One single-bit word per block word
+ */
+inline void bloom_mask(uint64_t hash, uint32_t mask[BLOOM_BLOCK_WORDS]) {
+    static const uint32_t salts[BLOOM_BLOCK_WORDS] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+    uint32_t key = static_cast<uint32_t>(hash);
+#if defined(__AVX2__)
+    __m256i products = _mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(key)),
+                                          _mm256_loadu_si256(
+                                              reinterpret_cast<const __m256i*>(salts)));
+    __m256i bits = _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_srli_epi32(products, 27));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask), bits);
+#else
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; ++i) {
+        mask[i] = 1u << ((key * salts[i]) >> 27);
+    }
+#endif
+}
+
+/**
+ * @brief Builds a split-block Bloom filter over the non-null values of a chunk
+ *
+ * The filter has about BLOOM_BITS_PER_VALUE bits per distinct value,
+ * rounded up to whole 256-bit blocks.
+ *
+ * @param[in] values Values of the chunk, NaN for nulls
+ * @param[out] num_blocks Number of blocks written
+ * @return Filter words, BLOOM_BLOCK_WORDS per block
+ */
+inline std::vector<uint32_t> encode_bloom(const std::vector<float>& values, size_t& num_blocks) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve(values.size());
+    for (float value : values) {
+        if (!std::isnan(value)) {
+            hashes.push_back(bloom_hash(value));
+        }
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    num_blocks = std::max<size_t>(1, (hashes.size() * BLOOM_BITS_PER_VALUE + 255) / 256);
+    std::vector<uint32_t> words(num_blocks * BLOOM_BLOCK_WORDS, 0);
+    uint32_t mask[BLOOM_BLOCK_WORDS];
+    for (uint64_t hash : hashes) {
+        bloom_mask(hash, mask);
+        uint32_t* block = words.data() + bloom_block(hash, num_blocks) * BLOOM_BLOCK_WORDS;
+        for (int i = 0; i < BLOOM_BLOCK_WORDS; ++i) {
+            block[i] |= mask[i];
+        }
+    }
+    return words;
+}
+
+/**
+ * @brief Tests a hash against one block of a Bloom filter
+ * @param[in] block The BLOOM_BLOCK_WORDS words of the block the hash falls in
+ * @param[in] hash Value hash
+ * @return false if the value is certainly absent
+ */
+inline bool bloom_check(const uint32_t* block, uint64_t hash) {
+    uint32_t mask[BLOOM_BLOCK_WORDS];
+    bloom_mask(hash, mask);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; ++i) {
+        if ((block[i] & mask[i]) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Lists the stored values an EQUAL filter can match
+ *
+ * EQUAL matches within a small epsilon, so a float filter value may equal
+ * a few neighbouring floats; integers can only equal the nearest integer.
+ * When the neighbourhood holds more than BLOOM_MAX_PROBES floats (values
+ * very close to 0) the Bloom filters cannot be used.
+ *
+ * @param[in] filter_value Value to compare against
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[out] probes Values to look up, possibly none
+ * @return false if the filter must scan instead
+ */
+inline bool bloom_probes(float filter_value, bool is_int, std::vector<float>& probes) {
+    probes.clear();
+    if (std::isnan(filter_value)) {
+        return true;
+    }
+    if (is_int) {
+        float nearest = std::round(filter_value);
+        if (apply_filter(nearest, EQUAL, filter_value)) {
+            probes.push_back(nearest);
+        }
+        return true;
+    }
+    for (float value = filter_value; apply_filter(value, EQUAL, filter_value);
+         value = std::nextafter(value, -INFINITY)) {
+        if (probes.size() == BLOOM_MAX_PROBES) {
+            return false;
+        }
+        probes.push_back(value);
+    }
+    for (float value = std::nextafter(filter_value, INFINITY);
+         apply_filter(value, EQUAL, filter_value); value = std::nextafter(value, INFINITY)) {
+        if (probes.size() == BLOOM_MAX_PROBES) {
+            return false;
+        }
+        probes.push_back(value);
+    }
+    return true;
+}
+
+/**
+ * @brief Counts the bytes a chunk occupies, trailing bitmaps and filters included
+ * @param[in] info Footer fields of the chunk
+ * @param[in] num_rows Number of rows in the chunk
+ * @return Bytes from the chunk's offset to the end of its last part
+ */
+inline long long chunk_extent(const nlohmann::json& info, int num_rows) {
+    long long start = info["offset"].get<long long>();
+    long long end = start + info["size"].get<long long>();
+    if (info.value("null_count", 0) > 0) {
+        end = std::max(end, info["validity_offset"].get<long long>() +
+                            static_cast<long long>((num_rows + 63) / 64 * sizeof(uint64_t)));
+    }
+    if (info.contains("bloom_offset")) {
+        end = std::max(end, info["bloom_offset"].get<long long>() +
+                            info["bloom_blocks"].get<long long>() * BLOOM_BLOCK_WORDS *
+                            static_cast<long long>(sizeof(uint32_t)));
+    }
+    return end - start;
+}
+
+/**
+ * @brief Moves a chunk entry to a new offset, its trailing parts with it
+ * @param[in,out] info Footer fields of the chunk
+ * @param[in] offset New offset of the chunk
+ */
+inline void relocate_chunk(nlohmann::json& info, long long offset) {
+    long long shift = offset - info["offset"].get<long long>();
+    for (const char* key : {"offset", "validity_offset", "bloom_offset"}) {
+        if (info.contains(key)) {
+            info[key] = info[key].get<long long>() + shift;
+        }
+    }
+}
+
+/**
+ * @brief Smallest and largest value and null count of a column in one segment
+ *
+ * Columnar chunks record theirs as the "min", "max" and "null_count"
+ * fields of the chunk entry. Row-major segments record a "zones" list
+ * with one [min, max, null_count] entry per column; min and max are null
+ * when the column has no values in the segment.
+ */
+struct ZoneMap {
+    float min = INFINITY;
+    float max = -INFINITY;
+    long long null_count = 0;
+    bool known = true;          // false if the segment recorded no zone map
+
+    /**
+     * @brief Adds one value
+     * @param[in] value Value to add, counted as a null if NaN
+     */
+    void add(float value) {
+        if (std::isnan(value)) {
+            ++null_count;
+            return;
+        }
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    /**
+     * @brief Adds the values of another zone
+     * @param[in] other Zone of other rows
+     */
+    void merge(const ZoneMap& other) {
+        known = known && other.known;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        null_count += other.null_count;
+    }
+
+    /**
+     * @brief Checks whether the zone holds any non-null value
+     * @return true if min and max are set
+     */
+    bool has_values() const {
+        return min <= max;
+    }
+
+    /**
+     * @brief Serializes the zone as a row-major "zones" entry
+     * @return [min, max, null_count]
+     */
+    nlohmann::json entry() const {
+        return {has_values() ? nlohmann::json(min) : nlohmann::json(),
+                has_values() ? nlohmann::json(max) : nlohmann::json(), null_count};
+    }
+};
+
+/**
+ * @brief Reads a row-major "zones" entry
+ * @param[in] entry [min, max, null_count] entry, or null if none was recorded
+ * @return Zone of the column, unknown for a null entry
+ */
+inline ZoneMap zone_from_entry(const nlohmann::json& entry) {
+    ZoneMap zone;
+    if (!entry.is_array() || entry.size() != 3) {
+        zone.known = false;
+        return zone;
+    }
+    if (!entry[0].is_null()) {
+        zone.min = entry[0].get<float>();
+        zone.max = entry[1].get<float>();
+    }
+    zone.null_count = entry[2].get<long long>();
+    return zone;
+}
+
+/**
+ * @brief Reads the zone map of a columnar chunk
+ *
+ * A lone "min" is the reference of an early frame-of-reference chunk,
+ * not a zone map.
+ *
+ * @param[in] info Footer fields of the chunk
+ * @param[in] num_rows Number of rows in the chunk
+ * @return Zone of the chunk, unknown if it was written without one
+ */
+inline ZoneMap zone_from_chunk(const nlohmann::json& info, int num_rows) {
+    ZoneMap zone;
+    zone.null_count = info.value("null_count", 0LL);
+    if (info.contains("min") && info.contains("max")) {
+        zone.min = info["min"].get<float>();
+        zone.max = info["max"].get<float>();
+    } else {
+        zone.known = zone.null_count == num_rows;
+    }
+    return zone;
+}
+
+/**
+ * @brief Computes the "zones" list of row-major rows
+ * @param[in] columns Column entries of the group
+ * @param[in] rows Rows laid out as on disk
+ * @param[in] num_rows Number of rows
+ * @return One [min, max, null_count] entry per column
+ */
+inline nlohmann::json row_major_zones(const nlohmann::json& columns, const float* rows,
+                                      long long num_rows) {
+    size_t num_columns = columns.size();
+    nlohmann::json zones = nlohmann::json::array();
+    for (size_t col = 0; col < num_columns; ++col) {
+        ZoneMap zone;
+        bool is_int = is_int_column(columns[col]);
+        for (long long row = 0; row < num_rows; ++row) {
+            zone.add(load_value(rows[row * num_columns + col], is_int));
+        }
+        zones.push_back(zone.entry());
+    }
+    return zones;
+}
+
+/**
+ * @brief Decides a filter for a whole segment from its zone map
+ *
+ * Nulls never pass a filter, so a segment where every value passes still
+ * has its null rows excluded.
+ *
+ * @param[in] zone Zone of the filtered column in the segment
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @return 1 if every non-null value passes, 0 if none does, -1 if it varies or is unknown
+ */
+inline int zone_verdict(const ZoneMap& zone, int operation, float filter_value) {
+    if (!zone.known) {
+        return -1;
+    }
+    if (!zone.has_values()) {
+        return 0;
+    }
+    bool all = false, none = false;
+    switch (operation) {
+        case GREATER_THAN:
+            all = zone.min > filter_value;
+            none = zone.max <= filter_value;
+            break;
+        case GREATER_EQUAL:
+            all = zone.min >= filter_value;
+            none = zone.max < filter_value;
+            break;
+        case LESS_THAN:
+            all = zone.max < filter_value;
+            none = zone.min >= filter_value;
+            break;
+        case LESS_EQUAL:
+            all = zone.max <= filter_value;
+            none = zone.min > filter_value;
+            break;
+        case EQUAL:
+        case NOT_EQUAL: {
+            // The values matching EQUAL form an interval, so the ends decide
+            bool all_equal = apply_filter(zone.min, EQUAL, filter_value) &&
+                             apply_filter(zone.max, EQUAL, filter_value);
+            bool none_equal = (zone.max < filter_value &&
+                               !apply_filter(zone.max, EQUAL, filter_value)) ||
+                              (zone.min > filter_value &&
+                               !apply_filter(zone.min, EQUAL, filter_value));
+            all = operation == EQUAL ? all_equal : none_equal;
+            none = operation == EQUAL ? none_equal : all_equal;
+            break;
+        }
+        default:
+            return -1;
+    }
+    return all ? 1 : none ? 0 : -1;
+}
+
+/**
+ * @brief Encodes one block of a columnar segment
+ *
+ * Each column becomes one chunk, encoded as its column entry asks and
+ * laid out back to back in column order. With "lz" compression, each
+ * encoded chunk that shrinks is stored compressed, with its encoded size
+ * recorded as raw_size. Nulls (NaN) are encoded as 0 and marked clear in
+ * a validity bitmap written after the chunk payload; chunks without nulls
+ * have no bitmap. Columns marked "bloom" end their chunk with a Bloom
+ * filter of its values. Every chunk with a value records the smallest
+ * and largest as its zone map.
+ *
+ * @param[in] columns Column entries of the group
+ * @param[in] values One vector of values per column, all of the same length
+ * @param[in] offset File offset the block will be written at
+ * @param[out] bytes Buffer receiving the chunk payloads
+ * @param[in] compression Group compression, empty for none
+ * @return Segment entry describing the block and its chunks
+ */
+inline nlohmann::json encode_block(const nlohmann::json& columns,
+                                   const std::vector<std::vector<float>>& values,
+                                   long long offset, std::string& bytes,
+                                   const std::string& compression = "") {
+    nlohmann::json segment = {{"offset", offset},
+                              {"num_rows", values[0].size()},
+                              {"chunks", nlohmann::json::array()}};
+    bytes.clear();
+    for (size_t col = 0; col < values.size(); ++col) {
+        std::vector<uint64_t> validity;
+        long long null_count = 0;
+        std::vector<float> present;
+        for (size_t row = 0; row < values[col].size(); ++row) {
+            if (!std::isnan(values[col][row])) {
+                continue;
+            }
+            if (null_count++ == 0) {
+                validity.assign((values[col].size() + 63) / 64, ~0ULL);
+                present = values[col];
+            }
+            validity[row / 64] &= ~(1ULL << (row % 64));
+            present[row] = 0.0f;
+        }
+
+        EncodedChunk chunk = encode_chunk(null_count == 0 ? values[col] : present,
+                                          is_int_column(columns[col]),
+                                          columns[col].value("encoding", "raw"));
+        if (compression == "lz" && !chunk.bytes.empty()) {
+            std::string compressed = lz_compress(chunk.bytes);
+            if (compressed.size() < chunk.bytes.size()) {
+                chunk.info["compression"] = compression;
+                chunk.info["raw_size"] = chunk.bytes.size();
+                chunk.bytes = std::move(compressed);
+            }
+        }
+        chunk.info["offset"] = offset + static_cast<long long>(bytes.size());
+        chunk.info["size"] = chunk.bytes.size();
+        ZoneMap zone;
+        for (float value : values[col]) {
+            zone.add(value);
+        }
+        if (zone.has_values()) {
+            chunk.info["min"] = zone.min;
+            chunk.info["max"] = zone.max;
+        }
+        if (null_count > 0) {
+            chunk.info["null_count"] = null_count;
+            chunk.info["validity_offset"] = offset + static_cast<long long>(bytes.size() +
+                                                                            chunk.bytes.size());
+            chunk.bytes.append(reinterpret_cast<const char*>(validity.data()),
+                               validity.size() * sizeof(uint64_t));
+        }
+        if (columns[col].value("bloom", false)) {
+            size_t num_blocks;
+            std::vector<uint32_t> bloom = encode_bloom(values[col], num_blocks);
+            chunk.info["bloom_offset"] = offset + static_cast<long long>(bytes.size() +
+                                                                         chunk.bytes.size());
+            chunk.info["bloom_blocks"] = num_blocks;
+            chunk.bytes.append(reinterpret_cast<const char*>(bloom.data()),
+                               bloom.size() * sizeof(uint32_t));
+        }
+        segment["chunks"].push_back(chunk.info);
+        bytes += chunk.bytes;
+    }
+    return segment;
+}
+
+/**
+ * @brief Reads the dictionary at the start of a dictionary chunk
+ * @param[in] info Footer fields of the chunk
+ * @param[in] bytes Chunk payload
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Dictionary values in code order
+ */
+inline std::vector<float> read_dictionary(const nlohmann::json& info, const std::string& bytes,
+                                          bool is_int) {
+    std::vector<float> dictionary(info["dict_size"].get<size_t>());
+    std::memcpy(dictionary.data(), bytes.data(), dictionary.size() * sizeof(float));
+    for (float& entry : dictionary) {
+        entry = load_value(entry, is_int);
+    }
+    return dictionary;
+}
+
+/**
+ * @brief Reads one dictionary code
+ * @param[in] codes Start of the code array
+ * @param[in] code_bytes Width of a code in bytes
+ * @param[in] row Row within the chunk
+ * @return Code of the row
+ */
+inline uint32_t read_code(const unsigned char* codes, int code_bytes, int row) {
+    if (code_bytes == 1) {
+        return codes[row];
+    }
+    uint16_t code;
+    std::memcpy(&code, codes + static_cast<size_t>(row) * 2, sizeof(code));
+    return code;
+}
+
+/**
+ * @brief Copies a packed payload into aligned 32-bit words
+ * @param[in] bytes Chunk payload
+ * @return Packed words
+ */
+inline std::vector<uint32_t> read_words(const std::string& bytes) {
+    std::vector<uint32_t> words(bytes.size() / sizeof(uint32_t));
+    std::memcpy(words.data(), bytes.data(), words.size() * sizeof(uint32_t));
+    return words;
+}
+
+/**
+ * @brief Reads the reference of a frame-of-reference chunk
+ *
+ * Early chunks stored it as "min", which chunk zone maps now use for the
+ * smallest non-null value, so "reference" wins when both are present.
+ *
+ * @param[in] info Footer fields of the chunk
+ * @return Value the packed offsets are added to
+ */
+inline int32_t for_reference(const nlohmann::json& info) {
+    return (info.contains("reference") ? info["reference"] : info["min"]).get<int32_t>();
+}
+
+/**
+ * @brief Decodes a chunk back into values
+ * @param[in] info Footer fields of the chunk
+ * @param[in] bytes Chunk payload
+ * @param[in] num_rows Number of rows in the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @return Values of the chunk
+ */
+inline std::vector<float> decode_chunk(const nlohmann::json& info, const std::string& bytes,
+                                       int num_rows, bool is_int) {
+    std::vector<float> values(num_rows);
+    const std::string encoding = info["encoding"];
+
+    if (encoding == "dict") {
+        std::vector<float> dictionary = read_dictionary(info, bytes, is_int);
+        int code_bytes = info["code_bits"].get<int>() / 8;
+        const unsigned char* codes = reinterpret_cast<const unsigned char*>(bytes.data()) +
+                                     dictionary.size() * sizeof(float);
+        for (int row = 0; row < num_rows; ++row) {
+            values[row] = dictionary[read_code(codes, code_bytes, row)];
+        }
+        return values;
+    }
+
+    if (encoding == "for") {
+        size_t num_groups = (values.size() + PACK_GROUP - 1) / PACK_GROUP;
+        values.resize(num_groups * PACK_GROUP);
+        unpack_integers(read_words(bytes).data(), info["bit_width"].get<int>(),
+                        for_reference(info), num_groups, values.data());
+        values.resize(num_rows);
+        return values;
+    }
+
+    if (encoding == "xor") {
+        decode_xor(bytes, num_rows, is_int, values.data());
+        return values;
+    }
+
+    if (encoding == "rle") {
+        std::vector<float> run_values;
+        std::vector<int32_t> run_lengths;
+        read_runs(info, bytes, is_int, run_values, run_lengths);
+        auto out = values.begin();
+        for (size_t run = 0; run < run_values.size(); ++run) {
+            out = std::fill_n(out, run_lengths[run], run_values[run]);
+        }
+        return values;
+    }
+
+    if (encoding == "delta" || encoding == "delta2") {
+        // Unpack the packed differences, then undo one or two levels of differencing
+        int order = encoding == "delta" ? 1 : 2;
+        size_t packed = std::max(num_rows - order, 0);
+        size_t num_groups = (packed + PACK_GROUP - 1) / PACK_GROUP;
+        std::vector<int32_t> integers(order + num_groups * PACK_GROUP);
+        unpack_integers(read_words(bytes).data(), info["bit_width"].get<int>(),
+                        info["reference"].get<int32_t>(), num_groups, integers.data() + order);
+        integers[0] = info["first"].get<int32_t>();
+        if (order == 2) {
+            integers[1] = info["first_delta"].get<int32_t>();
+            prefix_sum(integers.data() + 2, packed, integers[1]);
+            prefix_sum(integers.data() + 1, packed + 1, integers[0]);
+        } else {
+            prefix_sum(integers.data() + 1, packed, integers[0]);
+        }
+        std::copy(integers.begin(), integers.begin() + num_rows, values.begin());
+        return values;
+    }
+
+    std::memcpy(values.data(), bytes.data(), values.size() * sizeof(float));
+    for (float& value : values) {
+        value = load_value(value, is_int);
+    }
+    return values;
+}
+
+/**
+ * @brief Sets a range of bits in a bitmap
+ * @param[in,out] bitmap Bitmap to modify
+ * @param[in] first First bit to set
+ * @param[in] last One past the last bit to set
+ */
+inline void set_bits(std::vector<uint64_t>& bitmap, long long first, long long last) {
+    while (first < last) {
+        long long word_end = std::min(last, (first / 64 + 1) * 64);
+        int count = static_cast<int>(word_end - first);
+        uint64_t mask = count == 64 ? ~0ULL : ((1ULL << count) - 1) << (first % 64);
+        bitmap[first / 64] |= mask;
+        first = word_end;
+    }
+}
+
+/**
+ * @brief Counts the set bits in a range of a bitmap
+ * @param[in] bitmap Bitmap to read
+ * @param[in] first First bit to count
+ * @param[in] last One past the last bit to count
+ * @return Number of set bits in [first, last)
+ */
+inline long long count_bits(const std::vector<uint64_t>& bitmap, long long first, long long last) {
+    long long count = 0;
+    while (first < last) {
+        long long word_end = std::min(last, (first / 64 + 1) * 64);
+        int width = static_cast<int>(word_end - first);
+        uint64_t mask = width == 64 ? ~0ULL : ((1ULL << width) - 1) << (first % 64);
+        count += __builtin_popcountll(bitmap[first / 64] & mask);
+        first = word_end;
+    }
+    return count;
+}
+
+/**
+ * @brief ANDs a bitmap into another in place
+ *
+ * Uses 256-bit (AVX2) or 128-bit (SSE2) lanes when the compiler targets
+ * them, with a scalar loop for the tail and for other targets.
+ *
+ * @param[in,out] dst Bitmap to update
+ * @param[in] src Bitmap to AND with
+ * @param[in] words Number of words to combine
+ */
+inline void and_bitmaps(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= words; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= words; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_and_si128(a, b));
+    }
+#endif
+    for (; i < words; ++i) {
+        dst[i] &= src[i];
+    }
+}
+
+/**
+ * @brief ORs a bitmap into another in place
+ * @param[in,out] dst Bitmap to update
+ * @param[in] src Bitmap to OR with
+ * @param[in] words Number of words to combine
+ */
+inline void or_bitmaps(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= words; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= words; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(a, b));
+    }
+#endif
+    for (; i < words; ++i) {
+        dst[i] |= src[i];
+    }
+}
+
+/**
+ * @brief Clears the bits of null rows of a chunk in a row bitmap
+ *
+ * Chunks starting on a word boundary (every block, unless block_rows is
+ * not a multiple of 64) AND the validity words straight into the bitmap;
+ * others clear one bit per null row.
+ *
+ * @param[in,out] bitmap Bitmap over all rows
+ * @param[in] first_row Row id of the chunk's first row
+ * @param[in] validity Validity bitmap of the chunk, empty if it has no nulls
+ * @param[in] num_rows Number of rows in the chunk
+ */
+inline void and_validity(std::vector<uint64_t>& bitmap, long long first_row,
+                         const std::vector<uint64_t>& validity, int num_rows) {
+    if (validity.empty()) {
+        return;
+    }
+    if (first_row % 64 == 0) {
+        uint64_t* words = bitmap.data() + first_row / 64;
+        and_bitmaps(words, validity.data(), num_rows / 64);
+        if (num_rows % 64 != 0) {
+            // Keep the bits past the chunk, which belong to the next one
+            words[num_rows / 64] &= validity[num_rows / 64] | ~0ULL << (num_rows % 64);
+        }
+        return;
+    }
+    for (size_t word = 0; word < validity.size(); ++word) {
+        uint64_t nulls = ~validity[word];
+        if (word == validity.size() - 1 && num_rows % 64 != 0) {
+            nulls &= (1ULL << (num_rows % 64)) - 1;
+        }
+        while (nulls != 0) {
+            long long bit = first_row + static_cast<long long>(word) * 64 + __builtin_ctzll(nulls);
+            bitmap[bit / 64] &= ~(1ULL << (bit % 64));
+            nulls &= nulls - 1;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates a filter over the stored values of a chunk
+ *
+ * Dictionary chunks are filtered on their codes: the predicate is
+ * evaluated once per dictionary entry, and since codes preserve order the
+ * matching codes usually form one range tested with a single comparison
+ * per row. Run-length chunks evaluate the predicate once per run and set
+ * whole ranges of bits. Other encodings are decoded and compared value by
+ * value.
+ *
+ * @param[in] info Footer fields of the chunk
+ * @param[in] bytes Chunk payload
+ * @param[in] num_rows Number of rows in the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @param[in,out] selection Bitmap receiving a set bit per matching row
+ * @param[in] first_row Row id of the chunk's first row
+ */
+inline void filter_values(const nlohmann::json& info, const std::string& bytes, int num_rows,
+                          bool is_int, int operation, float filter_value,
+                          std::vector<uint64_t>& selection, long long first_row) {
+    if (info["encoding"] == "dict") {
+        std::vector<float> dictionary = read_dictionary(info, bytes, is_int);
+        int code_bytes = info["code_bits"].get<int>() / 8;
+        const unsigned char* codes = reinterpret_cast<const unsigned char*>(bytes.data()) +
+                                     dictionary.size() * sizeof(float);
+
+        // Translate the constant once: which codes match, and are they one range?
+        std::vector<uint8_t> matches(dictionary.size());
+        uint32_t low = dictionary.size(), high = 0;
+        for (uint32_t code = 0; code < dictionary.size(); ++code) {
+            matches[code] = apply_filter(dictionary[code], operation, filter_value);
+            if (matches[code]) {
+                low = std::min(low, code);
+                high = code + 1;
+            }
+        }
+        if (low >= high) {
+            return;
+        }
+        bool contiguous = std::count(matches.begin(), matches.end(), 1) ==
+                          static_cast<long>(high - low);
+
+        for (int row = 0; row < num_rows; ++row) {
+            uint32_t code = read_code(codes, code_bytes, row);
+            uint64_t match = contiguous ? code - low < high - low : matches[code];
+            long long bit = first_row + row;
+            selection[bit / 64] |= match << (bit % 64);
+        }
+        return;
+    }
+
+    if (info["encoding"] == "rle") {
+        std::vector<float> run_values;
+        std::vector<int32_t> run_lengths;
+        read_runs(info, bytes, is_int, run_values, run_lengths);
+        long long run_start = first_row;
+        for (size_t run = 0; run < run_values.size(); ++run) {
+            if (apply_filter(run_values[run], operation, filter_value)) {
+                set_bits(selection, run_start, run_start + run_lengths[run]);
+            }
+            run_start += run_lengths[run];
+        }
+        return;
+    }
+
+    std::vector<float> values = decode_chunk(info, bytes, num_rows, is_int);
+    for (int row = 0; row < num_rows; ++row) {
+        uint64_t match = apply_filter(values[row], operation, filter_value);
+        long long bit = first_row + row;
+        selection[bit / 64] |= match << (bit % 64);
+    }
+}
+
+/**
+ * @brief Evaluates a filter over a chunk into a selection bitmap
+ *
+ * Nulls are stored as 0 and never match: after the values are compared,
+ * their bits are cleared with the validity bitmap.
+ *
+ * @param[in] info Footer fields of the chunk
+ * @param[in] bytes Chunk payload
+ * @param[in] num_rows Number of rows in the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @param[in,out] selection Bitmap receiving a set bit per matching row
+ * @param[in] first_row Row id of the chunk's first row
+ * @param[in] validity Validity bitmap of the chunk, empty if it has no nulls
+ */
+inline void filter_chunk(const nlohmann::json& info, const std::string& bytes, int num_rows,
+                         bool is_int, int operation, float filter_value,
+                         std::vector<uint64_t>& selection, long long first_row,
+                         const std::vector<uint64_t>& validity = {}) {
+    filter_values(info, bytes, num_rows, is_int, operation, filter_value, selection, first_row);
+    and_validity(selection, first_row, validity, num_rows);
+}
+
+/**
+ * @brief Running SUM, COUNT, MIN and MAX of a column
+ */
+struct Aggregate {
+    double sum = 0.0;
+    long long count = 0;
+    float min = INFINITY;
+    float max = -INFINITY;
+
+    /**
+     * @brief Adds a value occurring a number of times
+     * @param[in] value Value to add, ignored if null (NaN)
+     * @param[in] times Number of occurrences, possibly zero
+     */
+    void add(float value, long long times) {
+        if (times <= 0 || std::isnan(value)) {
+            return;
+        }
+        sum += static_cast<double>(value) * times;
+        count += times;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    /**
+     * @brief Adds a block of values known only from its zone map
+     *
+     * Leaves the sum untouched, so only COUNT, MIN and MAX stay exact.
+     *
+     * @param[in] zone Zone of the block
+     * @param[in] num_rows Number of rows in the block, nulls included
+     */
+    void add_zone(const ZoneMap& zone, long long num_rows) {
+        count += num_rows - zone.null_count;
+        if (zone.has_values()) {
+            min = std::min(min, zone.min);
+            max = std::max(max, zone.max);
+        }
+    }
+};
+
+/**
+ * @brief Copies a range of bits of a bitmap into a bitmap of its own
+ * @param[in] bitmap Bitmap to read
+ * @param[in] first First bit to copy
+ * @param[in] count Number of bits to copy
+ * @return Bitmap whose bit i is bit first + i of the input
+ */
+inline std::vector<uint64_t> extract_bits(const std::vector<uint64_t>& bitmap, long long first,
+                                          int count) {
+    std::vector<uint64_t> words((count + 63) / 64);
+    int shift = static_cast<int>(first % 64);
+    for (size_t i = 0; i < words.size(); ++i) {
+        size_t word = first / 64 + i;
+        uint64_t high = shift != 0 && word + 1 < bitmap.size() ? bitmap[word + 1] << (64 - shift)
+                                                               : 0;
+        words[i] = bitmap[word] >> shift | high;
+    }
+    return words;
+}
+
+/**
+ * @brief Aggregates the selected rows of a chunk
+ *
+ * Run-length chunks are aggregated on (value, length) pairs: each run
+ * contributes its value times the number of its rows that are selected,
+ * without being expanded. A chunk with nulls first ANDs the selection
+ * into its validity bitmap, so null rows are simply not selected.
+ *
+ * @param[in] info Footer fields of the chunk
+ * @param[in] bytes Chunk payload
+ * @param[in] num_rows Number of rows in the chunk
+ * @param[in] is_int Whether the column is stored as integers
+ * @param[in] selection Bitmap of the rows to aggregate, empty for all rows
+ * @param[in] first_row Row id of the chunk's first row
+ * @param[in,out] aggregate Aggregate receiving the rows
+ * @param[in] validity Validity bitmap of the chunk, empty if it has no nulls
+ */
+inline void aggregate_chunk(const nlohmann::json& info, const std::string& bytes, int num_rows,
+                            bool is_int, const std::vector<uint64_t>& selection,
+                            long long first_row, Aggregate& aggregate,
+                            const std::vector<uint64_t>& validity = {}) {
+    if (!validity.empty()) {
+        std::vector<uint64_t> mask = validity;
+        if (!selection.empty()) {
+            std::vector<uint64_t> selected = extract_bits(selection, first_row, num_rows);
+            and_bitmaps(mask.data(), selected.data(), mask.size());
+        }
+        aggregate_chunk(info, bytes, num_rows, is_int, mask, 0, aggregate);
+        return;
+    }
+
+    if (info["encoding"] == "rle") {
+        std::vector<float> run_values;
+        std::vector<int32_t> run_lengths;
+        read_runs(info, bytes, is_int, run_values, run_lengths);
+        long long run_start = first_row;
+        for (size_t run = 0; run < run_values.size(); ++run) {
+            long long run_end = run_start + run_lengths[run];
+            aggregate.add(run_values[run], selection.empty() ? run_lengths[run]
+                                           : count_bits(selection, run_start, run_end));
+            run_start = run_end;
+        }
+        return;
+    }
+
+    std::vector<float> values = decode_chunk(info, bytes, num_rows, is_int);
+    for (int row = 0; row < num_rows; ++row) {
+        long long bit = first_row + row;
+        if (selection.empty() || (selection[bit / 64] >> (bit % 64) & 1)) {
+            aggregate.add(values[row], 1);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * @brief Fast byte-level block compressor for HTY column chunks
+ *
+ * An LZ77 compressor in the style of LZ4: a block is a series of
+ * sequences, each a token byte (literal count in the high nibble, match
+ * length minus LZ_MIN_MATCH in the low nibble, 15 meaning more length
+ * bytes follow), the literals, and a 2-byte little-endian match offset.
+ * The last sequence has literals only. Matches are found through a
+ * single-probe hash table, which trades some ratio for speed on both
+ * sides; decompression is a plain copy loop.
+ */
+
+#ifndef HTY_LZ_HPP
+#define HTY_LZ_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5      // Bytes at the end of a block always sent as literals
+
+/**
+ * @brief Appends a length beyond a nibble as a run of 255s and a remainder
+ * @param[in,out] out Compressed output
+ * @param[in] length Length minus the 15 already held by the token
+ */
+inline void lz_write_length(std::string& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+/**
+ * @brief Appends one sequence of literals and an optional match
+ * @param[in,out] out Compressed output
+ * @param[in] literals First literal byte
+ * @param[in] num_literals Number of literal bytes
+ * @param[in] offset Distance back to the match, 0 for the last sequence
+ * @param[in] match_length Length of the match, unused for the last sequence
+ */
+inline void lz_write_sequence(std::string& out, const char* literals, size_t num_literals,
+                              size_t offset, size_t match_length) {
+    size_t match_code = offset == 0 ? 0 : match_length - LZ_MIN_MATCH;
+    out.push_back(static_cast<char>((std::min<size_t>(num_literals, 15) << 4) |
+                                    std::min<size_t>(match_code, 15)));
+    if (num_literals >= 15) {
+        lz_write_length(out, num_literals - 15);
+    }
+    out.append(literals, num_literals);
+    if (offset == 0) {
+        return;
+    }
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15) {
+        lz_write_length(out, match_code - 15);
+    }
+}
+
+/**
+ * @brief Compresses a block
+ * @param[in] input Bytes to compress
+ * @return Compressed block
+ */
+inline std::string lz_compress(const std::string& input) {
+    std::string out;
+    out.reserve(input.size() / 2 + 16);
+    const char* src = input.data();
+    size_t size = input.size();
+
+    std::vector<uint32_t> table(1u << LZ_HASH_BITS, 0);   // Position + 1, 0 if empty
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t match_limit = size > LZ_LAST_LITERALS + LZ_MIN_MATCH + 3
+                         ? size - (LZ_LAST_LITERALS + LZ_MIN_MATCH + 3) : 0;
+
+    while (position < match_limit) {
+        uint32_t sequence;
+        std::memcpy(&sequence, src + position, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t entry = table[hash];
+        table[hash] = static_cast<uint32_t>(position + 1);
+        if (entry == 0 || position - (entry - 1) > LZ_MAX_OFFSET ||
+            std::memcmp(src + entry - 1, &sequence, sizeof(sequence)) != 0) {
+            ++position;
+            continue;
+        }
+        size_t candidate = entry - 1;
+
+        size_t length = LZ_MIN_MATCH;
+        while (position + length < size - LZ_LAST_LITERALS &&
+               src[candidate + length] == src[position + length]) {
+            ++length;
+        }
+        lz_write_sequence(out, src + anchor, position - anchor, position - candidate, length);
+        position += length;
+        anchor = position;
+    }
+
+    lz_write_sequence(out, src + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+/**
+ * @brief Reads a length continued past its nibble
+ * @param[in] in Compressed input
+ * @param[in] size Size of the compressed input
+ * @param[in,out] position Read position
+ * @param[in,out] length Length to extend
+ * @return false if the input ends early
+ */
+inline bool lz_read_length(const unsigned char* in, size_t size, size_t& position,
+                           size_t& length) {
+    unsigned char byte;
+    do {
+        if (position >= size) {
+            return false;
+        }
+        byte = in[position++];
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/**
+ * @brief Decompresses a block into a buffer of known size
+ * @param[in] input Compressed block
+ * @param[out] out Buffer of exactly the uncompressed size
+ * @param[in] out_size Uncompressed size
+ * @return false if the block is malformed
+ */
+inline bool lz_decompress(const std::string& input, char* out, size_t out_size) {
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(input.data());
+    size_t size = input.size();
+    size_t in_pos = 0, out_pos = 0;
+
+    while (in_pos < size) {
+        unsigned char token = in[in_pos++];
+        size_t num_literals = token >> 4;
+        if (num_literals == 15 && !lz_read_length(in, size, in_pos, num_literals)) {
+            return false;
+        }
+        if (in_pos + num_literals > size || out_pos + num_literals > out_size) {
+            return false;
+        }
+        std::memcpy(out + out_pos, in + in_pos, num_literals);
+        in_pos += num_literals;
+        out_pos += num_literals;
+        if (in_pos == size) {
+            break;   // Last sequence
+        }
+
+        if (in_pos + 2 > size) {
+            return false;
+        }
+        size_t offset = in[in_pos] | in[in_pos + 1] << 8;
+        in_pos += 2;
+        size_t length = token & 0x0F;
+        if (length == 15 && !lz_read_length(in, size, in_pos, length)) {
+            return false;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out_pos || out_pos + length > out_size) {
+            return false;
+        }
+
+        // Overlapping matches repeat the last offset bytes, so copy forward
+        char* dst = out + out_pos;
+        const char* from = dst - offset;
+        if (offset >= length) {
+            std::memcpy(dst, from, length);
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                dst[i] = from[i];
+            }
+        }
+        out_pos += length;
+    }
+    return out_pos == out_size;
+}
+
+#endif
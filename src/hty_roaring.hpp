@@ -0,0 +1,172 @@
+/**
+ * @brief Compressed (roaring-style) row bitmaps for HTY bitmap indexes
+ *
+ * Row ids are split into chunks of 65536 by their high 16 bits, and each
+ * non-empty chunk is stored as one container holding the low 16 bits in
+ * whichever form is smallest: a sorted array of ids, a 65536-bit bitmap,
+ * or a list of runs. A serialized bitmap is a uint32 container count, one
+ * RoaringContainer entry per container in key order, then the payloads in
+ * the same order.
+ */
+
+#ifndef HTY_ROARING_HPP
+#define HTY_ROARING_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "hty_encoding.hpp"
+
+#define ROARING_CHUNK_ROWS 65536
+#define ROARING_BITMAP_WORDS (ROARING_CHUNK_ROWS / 64)
+
+// Container types
+#define ROARING_ARRAY 0       // uint16 low bits of each row, ascending
+#define ROARING_BITMAP 1      // ROARING_BITMAP_WORDS 64-bit words
+#define ROARING_RUN 2         // uint16 (start, length - 1) pairs, ascending
+
+/**
+ * @brief Footer of one container in a serialized bitmap
+ */
+struct RoaringContainer {
+    uint16_t key;             // High 16 bits of the container's rows
+    uint16_t type;            // ROARING_ARRAY, ROARING_BITMAP or ROARING_RUN
+    uint32_t cardinality;     // Rows in the container
+    uint32_t size;            // Payload bytes
+};
+
+/**
+ * @brief Appends one container holding some rows of a chunk
+ * @param[in] lows Low 16 bits of the rows, ascending
+ * @param[in] key High 16 bits shared by the rows
+ * @param[in,out] containers Container entries
+ * @param[in,out] payloads Container payloads
+ */
+inline void roaring_add_container(const std::vector<uint16_t>& lows, uint16_t key,
+                                  std::vector<RoaringContainer>& containers,
+                                  std::string& payloads) {
+    std::vector<uint16_t> runs;
+    for (size_t i = 0; i < lows.size(); ++i) {
+        if (i == 0 || lows[i] != lows[i - 1] + 1) {
+            runs.push_back(lows[i]);
+            runs.push_back(0);
+        } else {
+            ++runs.back();
+        }
+    }
+
+    size_t array_size = lows.size() * sizeof(uint16_t);
+    size_t bitmap_size = ROARING_BITMAP_WORDS * sizeof(uint64_t);
+    size_t run_size = runs.size() * sizeof(uint16_t);
+    RoaringContainer container = {key, ROARING_ARRAY, static_cast<uint32_t>(lows.size()), 0};
+    size_t start = payloads.size();
+    if (run_size < array_size && run_size < bitmap_size) {
+        container.type = ROARING_RUN;
+        payloads.append(reinterpret_cast<const char*>(runs.data()), run_size);
+    } else if (array_size <= bitmap_size) {
+        payloads.append(reinterpret_cast<const char*>(lows.data()), array_size);
+    } else {
+        container.type = ROARING_BITMAP;
+        std::vector<uint64_t> words(ROARING_BITMAP_WORDS, 0);
+        for (uint16_t low : lows) {
+            words[low / 64] |= 1ULL << (low % 64);
+        }
+        payloads.append(reinterpret_cast<const char*>(words.data()), bitmap_size);
+    }
+    container.size = payloads.size() - start;
+    containers.push_back(container);
+}
+
+/**
+ * @brief Serializes a set of rows as a compressed bitmap
+ * @param[in] rows Row ids, ascending
+ * @return Serialized bitmap
+ */
+inline std::string roaring_encode(const std::vector<uint32_t>& rows) {
+    std::vector<RoaringContainer> containers;
+    std::string payloads;
+    std::vector<uint16_t> lows;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        lows.push_back(static_cast<uint16_t>(rows[i] & 0xFFFF));
+        if (i + 1 == rows.size() || rows[i + 1] >> 16 != rows[i] >> 16) {
+            roaring_add_container(lows, static_cast<uint16_t>(rows[i] >> 16), containers,
+                                  payloads);
+            lows.clear();
+        }
+    }
+
+    uint32_t count = containers.size();
+    std::string bytes(reinterpret_cast<const char*>(&count), sizeof(count));
+    bytes.append(reinterpret_cast<const char*>(containers.data()),
+                 containers.size() * sizeof(RoaringContainer));
+    return bytes + payloads;
+}
+
+/**
+ * @brief ORs a serialized bitmap into a plain bitmap over all rows
+ *
+ * Bitmap containers are ORed a word at a time (SIMD where available),
+ * runs set whole ranges, and arrays set one bit per row.
+ *
+ * @param[in] bytes Serialized bitmap
+ * @param[in,out] bitmap Plain bitmap, one bit per row
+ * @return false if the serialized bitmap is malformed
+ */
+inline bool roaring_or_into(const std::string& bytes, std::vector<uint64_t>& bitmap) {
+    uint32_t count;
+    if (bytes.size() < sizeof(count)) {
+        return false;
+    }
+    std::memcpy(&count, bytes.data(), sizeof(count));
+    size_t payload = sizeof(count) + static_cast<size_t>(count) * sizeof(RoaringContainer);
+    if (payload > bytes.size()) {
+        return false;
+    }
+
+    std::vector<uint64_t> words;
+    std::vector<uint16_t> values;
+    long long num_bits = static_cast<long long>(bitmap.size()) * 64;
+    for (uint32_t i = 0; i < count; ++i) {
+        RoaringContainer container;
+        std::memcpy(&container, bytes.data() + sizeof(count) + i * sizeof(container),
+                    sizeof(container));
+        bool size_valid = container.type == ROARING_BITMAP
+                          ? container.size == ROARING_BITMAP_WORDS * sizeof(uint64_t)
+                          : container.size % sizeof(uint16_t) == 0;
+        if (!size_valid || payload + container.size > bytes.size()) {
+            return false;
+        }
+        const char* data = bytes.data() + payload;
+        long long base = static_cast<long long>(container.key) * ROARING_CHUNK_ROWS;
+        payload += container.size;
+
+        if (container.type == ROARING_BITMAP) {
+            words.resize(container.size / sizeof(uint64_t));
+            std::memcpy(words.data(), data, container.size);
+            size_t first = base / 64;
+            size_t num_words = std::min(words.size(), bitmap.size() - std::min(first, bitmap.size()));
+            or_bitmaps(bitmap.data() + first, words.data(), num_words);
+            continue;
+        }
+
+        values.resize(container.size / sizeof(uint16_t));
+        std::memcpy(values.data(), data, container.size);
+        if (container.type == ROARING_RUN) {
+            for (size_t run = 0; run + 1 < values.size(); run += 2) {
+                long long start = base + values[run];
+                set_bits(bitmap, start, std::min(num_bits, start + values[run + 1] + 1));
+            }
+        } else {
+            for (uint16_t low : values) {
+                long long row = base + low;
+                if (row < num_bits) {
+                    bitmap[row / 64] |= 1ULL << (row % 64);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,263 @@
+/**
+ * @brief Per-column statistics kept in the HTY footer for selectivity estimates
+ *
+ * Each column entry may carry a "stats" object: the number of non-null
+ * values and of nulls, an equi-depth histogram of STATS_HISTOGRAM_BUCKETS
+ * buckets given by their bounds (every bucket holds the same share of the
+ * values), and a HyperLogLog sketch of the distinct values stored as hex.
+ * The converter and compaction compute them from scratch; appends fold
+ * their rows into the counts and the sketch and leave the histogram as is.
+ * The converter sees its rows one at a time and builds the histogram from
+ * a bounded sample of the values.
+ */
+
+#ifndef HTY_STATS_HPP
+#define HTY_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <charconv>
+#include <random>
+#include <nlohmann/json.hpp>
+#include "hty_encoding.hpp"
+
+#define STATS_HISTOGRAM_BUCKETS 32
+#define HLL_PRECISION 10                        // Bits of the hash choosing a register
+#define HLL_REGISTERS (1 << HLL_PRECISION)      // About 3% standard error
+#define STATS_SAMPLE_VALUES (1 << 16)           // Values sampled per column for a streamed histogram
+
+/**
+ * @brief Hashes a value for the distinct-count sketch
+ * @param[in] value Non-null value
+ * @return 64-bit hash, equal for 0 and -0
+ */
+inline uint64_t hll_hash(float value) {
+    uint32_t bits;
+    value = value == 0.0f ? 0.0f : value;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    // splitmix64 finalizer
+    uint64_t hash = bits + 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * @brief Adds a value to a distinct-count sketch
+ * @param[in,out] registers HLL_REGISTERS registers
+ * @param[in] value Non-null value
+ */
+inline void hll_add(std::vector<uint8_t>& registers, float value) {
+    uint64_t hash = hll_hash(value);
+    uint64_t rest = hash << HLL_PRECISION;
+    uint8_t rank = rest == 0 ? 64 - HLL_PRECISION + 1 : __builtin_clzll(rest) + 1;
+    uint8_t& slot = registers[hash >> (64 - HLL_PRECISION)];
+    slot = std::max(slot, rank);
+}
+
+/**
+ * @brief Estimates the number of distinct values added to a sketch
+ * @param[in] registers HLL_REGISTERS registers
+ * @return Estimated distinct count
+ */
+inline double hll_estimate(const std::vector<uint8_t>& registers) {
+    double sum = 0.0;
+    int zeros = 0;
+    for (uint8_t rank : registers) {
+        sum += std::ldexp(1.0, -rank);
+        zeros += rank == 0;
+    }
+    double m = registers.size();
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+
+    // Linear counting is more accurate while many registers are still empty
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * std::log(m / zeros);
+    }
+    return estimate;
+}
+
+/**
+ * @brief Serializes sketch registers as hex for the JSON footer
+ * @param[in] registers HLL_REGISTERS registers
+ * @return Two hex digits per register
+ */
+inline std::string hll_to_hex(const std::vector<uint8_t>& registers) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(registers.size() * 2);
+    for (uint8_t rank : registers) {
+        hex.push_back(digits[rank >> 4]);
+        hex.push_back(digits[rank & 0x0F]);
+    }
+    return hex;
+}
+
+/**
+ * @brief Parses sketch registers written by hll_to_hex
+ * @param[in] hex Footer value holding two hex digits per register
+ * @return HLL_REGISTERS registers, all zero if the value is malformed
+ */
+inline std::vector<uint8_t> hll_from_hex(const nlohmann::json& hex) {
+    std::vector<uint8_t> registers(HLL_REGISTERS, 0);
+    if (!hex.is_string() || hex.get_ref<const std::string&>().size() != registers.size() * 2) {
+        return registers;
+    }
+    const char* digits = hex.get_ref<const std::string&>().data();
+    for (size_t i = 0; i < registers.size(); ++i) {
+        const char* last = digits + i * 2 + 2;
+        auto [ptr, error] = std::from_chars(digits + i * 2, last, registers[i], 16);
+        if (error != std::errc() || ptr != last) {
+            return std::vector<uint8_t>(HLL_REGISTERS, 0);
+        }
+    }
+    return registers;
+}
+
+/**
+ * @brief Computes the statistics of a whole column
+ * @param[in] values Every value of the column, NaN for nulls
+ * @return "stats" object for the column entry
+ */
+inline nlohmann::json column_statistics(std::vector<float> values) {
+    std::vector<uint8_t> registers(HLL_REGISTERS, 0);
+    size_t num_values = 0;
+    for (float value : values) {
+        if (!std::isnan(value)) {
+            values[num_values++] = value;
+            hll_add(registers, value);
+        }
+    }
+    long long null_count = values.size() - num_values;
+    values.resize(num_values);
+    std::sort(values.begin(), values.end());
+
+    // Bound i is the value of rank i/B; the last bound is the maximum
+    nlohmann::json histogram = nlohmann::json::array();
+    for (size_t i = 0; i <= STATS_HISTOGRAM_BUCKETS && num_values > 0; ++i) {
+        histogram.push_back(values[std::min(num_values - 1,
+                                            i * num_values / STATS_HISTOGRAM_BUCKETS)]);
+    }
+    return {{"num_values", num_values}, {"null_count", null_count},
+            {"histogram", histogram}, {"hll", hll_to_hex(registers)}};
+}
+
+/**
+ * @brief Builds the statistics of a column from values seen one at a time
+ *
+ * Counts and the sketch cover every value. The histogram is computed from
+ * a uniform (reservoir) sample of STATS_SAMPLE_VALUES values with its end
+ * bounds set to the exact minimum and maximum, so memory stays bounded and
+ * columns no longer than the sample get the same statistics as
+ * column_statistics.
+ */
+struct StatisticsBuilder {
+    std::vector<uint8_t> registers = std::vector<uint8_t>(HLL_REGISTERS, 0);
+    std::vector<float> sample;      // Non-null values kept for the histogram
+    long long num_values = 0;
+    long long null_count = 0;
+    float min = INFINITY;
+    float max = -INFINITY;
+    std::mt19937_64 random{0};      // Fixed seed, so a conversion is reproducible
+
+    /**
+     * @brief Adds one value
+     * @param[in] value Value as stored, NaN for a null
+     */
+    void add(float value) {
+        if (std::isnan(value)) {
+            ++null_count;
+            return;
+        }
+        hll_add(registers, value);
+        min = std::min(min, value);
+        max = std::max(max, value);
+        if (num_values < STATS_SAMPLE_VALUES) {
+            sample.push_back(value);
+        } else {
+            unsigned long long slot = random() % (num_values + 1);
+            if (slot < STATS_SAMPLE_VALUES) {
+                sample[slot] = value;
+            }
+        }
+        ++num_values;
+    }
+
+    /**
+     * @brief Produces the "stats" object of the values added so far
+     * @return "stats" object for the column entry
+     */
+    nlohmann::json finish() const {
+        nlohmann::json stats = column_statistics(sample);
+        stats["num_values"] = num_values;
+        stats["null_count"] = null_count;
+        stats["hll"] = hll_to_hex(registers);
+        if (num_values > 0) {
+            stats["histogram"].front() = min;
+            stats["histogram"].back() = max;
+        }
+        return stats;
+    }
+};
+
+/**
+ * @brief Estimates the share of a column's rows that pass a filter
+ *
+ * Ranges interpolate linearly within histogram buckets. Equality takes
+ * the larger of one distinct value's share and the share of buckets
+ * whose bounds are all equal to the value, so frequent values that fill
+ * whole buckets are not underestimated.
+ *
+ * @param[in] stats "stats" object of the column entry
+ * @param[in] operation Filter operation to apply
+ * @param[in] filter_value Value to compare against
+ * @return Estimated share of the rows, nulls included, between 0 and 1
+ */
+inline double estimate_selectivity(const nlohmann::json& stats, int operation,
+                                   float filter_value) {
+    std::vector<double> bounds = stats["histogram"].get<std::vector<double>>();
+    double num_values = stats["num_values"].get<double>();
+    double total = num_values + stats["null_count"].get<double>();
+    if (bounds.size() < 2 || total == 0 || std::isnan(filter_value)) {
+        return 0.0;
+    }
+    double value = filter_value;
+    double buckets = bounds.size() - 1;
+
+    double less = 0.0, heavy = 0.0;
+    for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+        if (bounds[i + 1] < value) {
+            less += 1.0;
+        } else if (bounds[i] < value) {
+            less += (value - bounds[i]) / (bounds[i + 1] - bounds[i]);
+        }
+        heavy += bounds[i] == value && bounds[i + 1] == value;
+    }
+    less /= buckets;
+
+    double equal = 0.0;
+    if (value >= bounds.front() && value <= bounds.back()) {
+        double distinct = std::clamp(hll_estimate(hll_from_hex(stats["hll"])), 1.0,
+                                     std::max(1.0, num_values));
+        equal = std::max(1.0 / distinct, heavy / buckets);
+    }
+
+    double share;
+    switch (operation) {
+        case LESS_THAN:     share = less; break;
+        case LESS_EQUAL:    share = less + equal; break;
+        case GREATER_THAN:  share = 1.0 - less - equal; break;
+        case GREATER_EQUAL: share = 1.0 - less; break;
+        case EQUAL:         share = equal; break;
+        case NOT_EQUAL:     share = 1.0 - equal; break;
+        default:            share = 0.0; break;
+    }
+    return std::clamp(share, 0.0, 1.0) * num_values / total;
+}
+
+#endif